@@ -0,0 +1,121 @@
+// flat_hash_benchmark.cpp : The flat hash tables of flat_hash.h against unordered_set and
+// unordered_map, on the same keys.
+//
+// build: tools/build.sh benchmarks/flat_hash_benchmark.cpp flat_hash_benchmark
+// usage: flat_hash_benchmark [number of keys]
+//
+
+#include "flat_hash.h"
+#include <unordered_set>
+#include <unordered_map>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <cstdlib>
+#include <new>
+
+using namespace std;
+
+/*
+ * The data: 20 million keys by default, drawn with mt19937_64 (seed 5) uniformly from
+ * [0, keys / 2), so about 43% of them are distinct and the rest are repeats,
+ * like the word numbers of a subreddit. The sets insert the numbers, then look up
+ * every number + 1 (half of them are there). The maps do the same with the numbers as
+ * strings ("w" and the number), mapping them to a counter, like the word map of
+ * exercise 1.
+ * The memory is counted by replacing the global operator new and delete, so it's the
+ * bytes really allocated by the container, with the nodes and buckets of the unordered
+ * containers and the table arrays of the flat ones. Both the size of the full container
+ * and the peak while it was growing are printed (a flat table has the old and the new
+ * array at the same time while it grows).
+ */
+size_t allocated = 0;
+size_t peak = 0;
+size_t full = 0;
+
+void* operator new(size_t size) {
+	size_t* block = (size_t*)malloc(size + sizeof(size_t));
+	if (block == nullptr) {
+		throw bad_alloc();
+	}
+	block[0] = size;
+	allocated += size;
+	peak = max(peak, allocated);
+	return block + 1;
+}
+
+void operator delete(void* pointer) noexcept {
+	if (pointer != nullptr) {
+		size_t* block = (size_t*)pointer - 1;
+		allocated -= block[0];
+		free(block);
+	}
+}
+
+void operator delete(void* pointer, size_t) noexcept {
+	operator delete(pointer);
+}
+
+// runs the test, and prints it's time and the peak of the memory allocated meanwhile.
+template <class Test>
+void measure(string name, Test test) {
+	size_t before = allocated;
+	peak = allocated;
+	auto start = chrono::steady_clock::now();
+	long found = test();
+	double seconds = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start).count() / 1000.0;
+	cout << name << ": " << seconds << " s, " << (full - before) / 1048576.0 << " Mb full, " << (peak - before) / 1048576.0 << " Mb peak (found " << found << ")" << endl;
+}
+
+template <class Set>
+long insert_numbers(const vector<long>& keys) {
+	Set set;
+	for (const auto& key : keys) {
+		set.insert(key);
+	}
+	full = allocated;
+	long found = 0;
+	for (const auto& key : keys) {
+		found += set.count(key + 1);
+	}
+	return found;
+}
+
+template <class Map>
+long insert_words(const vector<string>& words) {
+	Map map;
+	long next = 1;
+	for (const auto& word : words) {
+		long& number = map[word];
+		if (number == 0) {
+			number = next++;
+		}
+	}
+	full = allocated;
+	return next - 1;
+}
+
+int main(int argc, char* argv[])
+{
+	long n = argc > 1 ? atol(argv[1]) : 20000000;
+	mt19937_64 random(5);
+	vector<long> keys(n);
+	for (auto& key : keys) {
+		key = random() % (n / 2);
+	}
+	cout << n << " numbers" << endl;
+	measure("unordered_set<long>", [&keys]() { return insert_numbers<unordered_set<long>>(keys); });
+	measure("FlatHashSet<long>", [&keys]() { return insert_numbers<FlatHashSet<long>>(keys); });
+
+	vector<string> words;
+	words.reserve(n);
+	for (const auto& key : keys) {
+		words.push_back("w" + to_string(key));
+	}
+	cout << n << " words" << endl;
+	measure("unordered_map<string, long>", [&words]() { return insert_words<unordered_map<string, long>>(words); });
+	measure("FlatHashMap<string, long>", [&words]() { return insert_words<FlatHashMap<string, long>>(words); });
+	return 0;
+}
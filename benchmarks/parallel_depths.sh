@@ -0,0 +1,44 @@
+#!/bin/bash
+# parallel_depths.sh : The second phase of exercise 3 on one giant subreddit, with the
+# parallel pointer jumping of find_deepest_in_parallel and with the level by level scan
+# of do_sorting_work.
+#
+# usage: benchmarks/parallel_depths.sh [comments] [work directory]
+#
+# The input is synthetic: one subreddit with the given number of comments (2 million
+# by default), in one thread, 2% of them reply to the thread starter, the others to an
+# earlier comment chosen at random (awk's rand with seed 1, so the input is the same
+# every time). The same task3 is built twice, once as it is, and
+# once with a threshold no subreddit reaches, so every subreddit goes to
+# do_sorting_work. Both print the same average depth, the times are printed by time.
+
+set -e
+comments=${1:-2000000}
+work=${2:-$(mktemp -d)}
+tools=$(cd "$(dirname "$0")/../tools" && pwd)
+mkdir -p "$work"
+
+awk -v n="$comments" '
+function b36(i,   s) {
+	s = ""
+	do {
+		s = substr("0123456789abcdefghijklmnopqrstuvwxyz", i % 36 + 1, 1) s
+		i = int(i / 36)
+	} while (i > 0)
+	return s
+}
+BEGIN {
+	srand(1)
+	for (i = 0; i < n; ++i) {
+		parent = (i == 0 || rand() < 0.02) ? "t3_x" : "t1_" b36(int(rand() * i))
+		printf "{\"subreddit\":\"Giant\",\"name\":\"t1_%s\",\"parent_id\":\"%s\",\"link_id\":\"t3_x\",\"created_utc\":%d}\n", b36(i), parent, 1500000000 + i
+	}
+}' > "$work/giant.json"
+
+"$tools/build.sh" task3 "$work/task3_parallel"
+"$tools/build.sh" task3 "$work/task3_serial" -DGIANT_SUBREDDIT_COMMENTS=2000000000
+
+for program in task3_parallel task3_serial; do
+	echo "--- $program ($comments comments)"
+	time "$work/$program" --input "$work/giant.json" </dev/null | tail -1
+done
@@ -0,0 +1,64 @@
+#!/bin/bash
+# sort_based.sh : Exercise 1 with the sets of Subreddits (the default) and with the
+# sorted runs of --sort-based, on the same input.
+#
+# usage: benchmarks/sort_based.sh [comments] [work directory]
+#
+# The input is synthetic: the given number of comments (500 thousand by default) of 2000
+# subreddits, with 30 words each from a vocabulary of 200 thousand words. The
+# subreddits and the words are skewed (the number of a subreddit is 2000 * r^2 and the
+# number of a word 200000 * r^3 for a random r, awk's rand with seed 1), so there are a
+# few big subreddits and a long tail, like in the dumps. Both modes print the same
+# list. The time (and the peak memory, if /usr/bin/time is there) of every run is
+# printed. The sort-based mode is run once more, built with 8 Mb batches and a budget
+# of 16 Mb for the runs in memory, so it merges and spills it's runs to the work
+# directory.
+
+set -e
+comments=${1:-500000}
+work=${2:-$(mktemp -d)}
+tools=$(cd "$(dirname "$0")/../tools" && pwd)
+mkdir -p "$work"
+
+awk -v n="$comments" '
+function word(i,   s) {
+	s = ""
+	do {
+		s = substr("abcdefghijklmnopqrstuvwxyz", i % 26 + 1, 1) s
+		i = int(i / 26)
+	} while (i > 0)
+	return s
+}
+BEGIN {
+	srand(1)
+	for (i = 0; i < n; ++i) {
+		r = rand()
+		body = ""
+		for (w = 0; w < 30; ++w) {
+			r3 = rand()
+			body = body (w > 0 ? " " : "") word(int(200000 * r3 * r3 * r3))
+		}
+		printf "{\"subreddit\":\"sub%d\",\"author\":\"a%d\",\"body\":\"%s\",\"created_utc\":%d}\n", int(2000 * r * r), i % 5000, body, 1500000000 + i
+	}
+}' > "$work/words.json"
+
+"$tools/build.sh" task1 "$work/task1"
+"$tools/build.sh" task1 "$work/task1_small_budget" "-DSORT_BATCH_KEYS=(1 << 20)" "-DSORT_RUNS_BUDGET=(16 << 20)"
+
+run() {
+	program=$1
+	shift
+	echo "--- $program $*"
+	if [ -x /usr/bin/time ]; then
+		/usr/bin/time -f "%e s, %M Kb peak" "$work/$program" --input "$work/words.json" "$@" </dev/null > "$work/output.txt"
+	else
+		time "$work/$program" --input "$work/words.json" "$@" </dev/null > "$work/output.txt"
+	fi
+	grep -E "^[^ ]+: [0-9]+$" "$work/output.txt" | tail -3
+	echo "$(grep -c "^spilled" "$work/output.txt") runs spilled"
+}
+
+run task1
+run task1 --sort-based
+mkdir -p "$work/spill"
+run task1_small_budget --sort-based --spill "$work/spill"
@@ -0,0 +1,129 @@
+// binary_io.h : The compact binary format of the partial results, the spilled
+// partitions and the block indexes of all three programs.
+//
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <istream>
+#include <ostream>
+#include <algorithm>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+/*
+ * The partial results, the spilled partitions and the block indexes are written in a
+ * compact binary format. Every number is a varint (7 bits per byte, the highest bit is
+ * set if there are more bytes), every string is it's length followed by the
+ * characters, and every set of numbers is sorted and stored as the differences between
+ * consecutive numbers, which are mostly small.
+ */
+inline void write_varint(std::ostream& out, unsigned long long value) {
+	while (value >= 0x80) {
+		out.put((char)(value | 0x80));
+		value >>= 7;
+	}
+	out.put((char)value);
+}
+
+/*
+ * The readers must not trust the files: a mapper killed while writing it's partial
+ * leaves a truncated file, and a broken index or spill file can have any bytes. A
+ * varint which does not end before the end of the file (or is longer than 64 bits)
+ * sets the failbit of the stream, and so does a length or a count (read_length) which
+ * is larger than the rest of the file, as every element takes at least one byte.
+ * Without this a garbage length would be allocated, and a garbage count would keep a
+ * loop going after the end of the file. The loops of the readers check in.good().
+ */
+inline unsigned long long read_varint(std::istream& in) {
+	unsigned long long value = 0;
+	for (int shift = 0; shift < 64; shift += 7) {
+		int c = in.get();
+		if (c == EOF) {
+			in.setstate(std::ios::failbit);
+			return 0;
+		}
+		value |= (unsigned long long)(c & 0x7f) << shift;
+		if ((c & 0x80) == 0) {
+			return value;
+		}
+	}
+	in.setstate(std::ios::failbit);
+	return 0;
+}
+
+// the number of bytes after the current position of the stream.
+inline unsigned long long bytes_left(std::istream& in) {
+	std::streampos position = in.tellg();
+	if (position < 0) {
+		return 0;
+	}
+	in.seekg(0, std::ios::end);
+	std::streampos end = in.tellg();
+	in.seekg(position);
+	return end > position ? (unsigned long long)(end - position) : 0;
+}
+
+// the short lengths are not checked, so most strings do not need the seeks of bytes_left.
+const unsigned long long UNCHECKED_LENGTH = 4096;
+
+inline unsigned long long read_length(std::istream& in) {
+	unsigned long long length = read_varint(in);
+	if (in.good() && length > UNCHECKED_LENGTH && length > bytes_left(in)) {
+		in.setstate(std::ios::failbit);
+	}
+	return in.good() ? length : 0;
+}
+
+inline void write_string(std::ostream& out, const std::string& s) {
+	write_varint(out, s.size());
+	out.write(s.data(), s.size());
+}
+
+inline std::string read_string(std::istream& in) {
+	std::string s(read_length(in), '\0');
+	in.read(&s[0], s.size());
+	return in.good() ? s : std::string();
+}
+
+inline void write_numbers(std::ostream& out, std::vector<long> numbers) {
+	std::sort(numbers.begin(), numbers.end());
+	write_varint(out, numbers.size());
+	long previous = 0;
+	for (const auto& number : numbers) {
+		write_varint(out, number - previous);
+		previous = number;
+	}
+}
+
+inline std::vector<long> read_numbers(std::istream& in) {
+	std::vector<long> numbers(read_length(in));
+	long previous = 0;
+	for (auto& number : numbers) {
+		number = previous + read_varint(in);
+		previous = number;
+	}
+	return numbers;
+}
+
+inline long process_id() {
+#ifdef _WIN32
+	return GetCurrentProcessId();
+#else
+	return getpid();
+#endif
+}
+
+/*
+ * The spill files and the sorted runs are named after the program and the process id
+ * (for example ./task2-1234-partition-5.spill), so several runs can use the same spill
+ * directory, and the files left behind by a crashed run are never read as part of a
+ * new one.
+ */
+inline std::string spill_file_path(const std::string& directory, const std::string& program, const std::string& name) {
+	return directory + "/" + program + "-" + std::to_string(process_id()) + "-" + name;
+}
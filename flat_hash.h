@@ -0,0 +1,456 @@
+// flat_hash.h : Flat (open addressing) hash tables, used instead of unordered_map and
+// unordered_set by all three exercises.
+//
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <functional>
+#include <stdexcept>
+#include <iterator>
+#include <cstddef>
+
+/*
+ * unordered_map and unordered_set allocate a separate node for every element,
+ * and every lookup follows a pointer to a bucket and then to the nodes. With millions
+ * of words and authors that is a lot of small allocations and cache misses.
+ *
+ * The tables here store the elements directly in one array (open addressing with
+ * linear probing, Robin Hood style): next to the array of elements there is an array
+ * of one byte per slot, which is 0 for an empty slot, or the distance of the element
+ * from it's home slot plus one. When inserting, an element takes the place of any
+ * element which is closer to it's own home than the new one is (that one continues
+ * looking for a place instead), so the probe sequences stay short, and a lookup can
+ * stop as soon as it finds an element closer to home than the key would be.
+ *
+ * The home slot is computed with fibonacci hashing (multiplying the hash with 2^64 /
+ * golden ratio and taking the upper bits), so integer keys can simply use their own
+ * value as the hash.
+ *
+ * The API is a subset of unordered_map / unordered_set, so they can be used the same
+ * way. Note that unlike the node based containers, inserting can move the elements,
+ * so iterators and references are only valid until the next insert (or erase).
+ */
+
+/*
+ * Hash functions. Integers are their own hash (see above). Strings use FNV-1a, which
+ * can be computed the same way for a string or a C string, so a C string can be used
+ * to look up string keys without creating a string first.
+ */
+template <class Key>
+struct FlatHash {
+	size_t operator()(const Key& key) const {
+		return std::hash<Key>()(key);
+	}
+};
+
+template <>
+struct FlatHash<long> {
+	size_t operator()(long key) const {
+		return (size_t)key;
+	}
+};
+
+template <>
+struct FlatHash<unsigned long long> {
+	size_t operator()(unsigned long long key) const {
+		return (size_t)key;
+	}
+};
+
+inline size_t flat_hash_bytes(const char* data, size_t size) {
+	unsigned long long hash = 14695981039346656037ULL;
+	for (size_t i = 0; i < size; ++i) {
+		hash ^= (unsigned char)data[i];
+		hash *= 1099511628211ULL;
+	}
+	return (size_t)hash;
+}
+
+template <>
+struct FlatHash<std::string> {
+	size_t operator()(const std::string& key) const {
+		return flat_hash_bytes(key.data(), key.size());
+	}
+
+	size_t operator()(const char* key) const {
+		return flat_hash_bytes(key, std::char_traits<char>::length(key));
+	}
+};
+
+// returns the key of an element of a set (the element itself) or a map (first).
+struct FlatSetKey {
+	template <class Slot>
+	const Slot& operator()(const Slot& slot) const {
+		return slot;
+	}
+};
+
+struct FlatMapKey {
+	template <class Slot>
+	const typename Slot::first_type& operator()(const Slot& slot) const {
+		return slot.first;
+	}
+};
+
+/*
+ * Iterator over the occupied slots. SlotPointer is Slot* or const Slot*.
+ */
+template <class Slot, class SlotPointer>
+class FlatIterator {
+	SlotPointer slots;
+	const unsigned char* distances;
+	size_t index;
+	size_t size;
+
+	void skip_empty() {
+		while (index < size && distances[index] == 0) {
+			++index;
+		}
+	}
+public:
+	typedef std::forward_iterator_tag iterator_category;
+	typedef Slot value_type;
+	typedef std::ptrdiff_t difference_type;
+	typedef SlotPointer pointer;
+	typedef decltype(*SlotPointer()) reference;
+
+	FlatIterator() {
+		slots = nullptr;
+		distances = nullptr;
+		index = 0;
+		size = 0;
+	}
+
+	FlatIterator(SlotPointer slots_in, const unsigned char* distances_in, size_t index_in, size_t size_in) {
+		slots = slots_in;
+		distances = distances_in;
+		index = index_in;
+		size = size_in;
+		skip_empty();
+	}
+
+	// a mutable iterator can be used where a const one is needed.
+	operator FlatIterator<Slot, const Slot*>() const {
+		return FlatIterator<Slot, const Slot*>(slots, distances, index, size);
+	}
+
+	decltype(*SlotPointer()) operator*() const {
+		return slots[index];
+	}
+
+	SlotPointer operator->() const {
+		return &slots[index];
+	}
+
+	FlatIterator& operator++() {
+		++index;
+		skip_empty();
+		return *this;
+	}
+
+	FlatIterator operator++(int) {
+		FlatIterator previous = *this;
+		++(*this);
+		return previous;
+	}
+
+	bool operator==(const FlatIterator& other) const {
+		return index == other.index;
+	}
+
+	bool operator!=(const FlatIterator& other) const {
+		return index != other.index;
+	}
+
+	size_t get_index() const {
+		return index;
+	}
+};
+
+/*
+ * The table itself, FlatHashMap and FlatHashSet only add the map / set specific
+ * functions on top of it.
+ */
+template <class Key, class Slot, class KeyOf, class Hash>
+class FlatTable {
+protected:
+	std::vector<Slot> slots;
+	// 0: empty slot, otherwise the distance from the home slot + 1.
+	std::vector<unsigned char> distances;
+	size_t number_of_elements;
+	// 64 - log2(number of slots), for the fibonacci hashing.
+	int shift;
+	Hash hasher;
+
+	static const size_t NOT_FOUND = (size_t)-1;
+	// the distances have to fit in a byte, if an element would be further, we grow.
+	static const int MAX_DISTANCE = 255;
+
+	template <class K>
+	size_t home(const K& key) const {
+		return (size_t)(((unsigned long long)hasher(key) * 0x9E3779B97F4A7C15ULL) >> shift);
+	}
+
+	template <class K>
+	size_t find_index(const K& key) const {
+		if (number_of_elements == 0) {
+			return NOT_FOUND;
+		}
+		size_t mask = slots.size() - 1;
+		size_t index = home(key);
+		for (int distance = 1; distance <= distances[index]; ++distance) {
+			if (distances[index] == distance && KeyOf()(slots[index]) == key) {
+				return index;
+			}
+			index = (index + 1) & mask;
+		}
+		return NOT_FOUND;
+	}
+
+	/*
+	 * Puts the element in the table. Returns the slot where the element ended up, or
+	 * NOT_FOUND if some element would be too far from home. In that case the element
+	 * which could not be placed (not necessarily the one we started with) is left in
+	 * slot, and the table has to grow.
+	 */
+	size_t place(Slot& slot) {
+		size_t mask = slots.size() - 1;
+		size_t index = home(KeyOf()(slot));
+		size_t result = NOT_FOUND;
+		for (int distance = 1; distance <= MAX_DISTANCE; ++distance) {
+			if (distances[index] == 0) {
+				slots[index] = std::move(slot);
+				distances[index] = (unsigned char)distance;
+				number_of_elements++;
+				return result == NOT_FOUND ? index : result;
+			}
+			// Robin Hood: take the place of an element which is closer to it's home.
+			if (distances[index] < distance) {
+				std::swap(slot, slots[index]);
+				int tmp = distances[index];
+				distances[index] = (unsigned char)distance;
+				distance = tmp;
+				if (result == NOT_FOUND) {
+					result = index;
+				}
+			}
+			index = (index + 1) & mask;
+		}
+		return NOT_FOUND;
+	}
+
+	// rebuilds the table with the given number of slots (a power of 2). The element in
+	// extra (if not null) is put in as well.
+	void rehash(size_t size, Slot* extra) {
+		std::vector<Slot> old_slots(size);
+		std::vector<unsigned char> old_distances(size, 0);
+		old_slots.swap(slots);
+		old_distances.swap(distances);
+		shift = 64;
+		for (size_t s = size; s > 1; s >>= 1) {
+			shift--;
+		}
+		number_of_elements = 0;
+		for (size_t i = 0; i < old_slots.size(); ++i) {
+			if (old_distances[i] != 0) {
+				insert_slot(old_slots[i]);
+			}
+		}
+		if (extra != nullptr) {
+			insert_slot(*extra);
+		}
+	}
+
+	// places the slot, growing the table as many times as needed.
+	void insert_slot(Slot& slot) {
+		if (place(slot) == NOT_FOUND) {
+			Slot left_over = std::move(slot);
+			rehash(slots.size() * 2, &left_over);
+		}
+	}
+
+	// we keep the table at most 7/8 full.
+	void grow_for(size_t elements) {
+		size_t size = slots.empty() ? 16 : slots.size();
+		while (elements * 8 > size * 7) {
+			size *= 2;
+		}
+		if (size != slots.size()) {
+			rehash(size, nullptr);
+		}
+	}
+
+	/*
+	 * Finds the key, or inserts the element made by make_slot() if it's not there yet.
+	 * Returns the slot of the element, and whether it was inserted.
+	 */
+	template <class K, class MakeSlot>
+	std::pair<size_t, bool> find_or_insert(const K& key, MakeSlot make_slot) {
+		size_t index = find_index(key);
+		if (index != NOT_FOUND) {
+			return std::make_pair(index, false);
+		}
+		grow_for(number_of_elements + 1);
+		Slot slot = make_slot();
+		index = place(slot);
+		if (index == NOT_FOUND) {
+			Slot left_over = std::move(slot);
+			rehash(slots.size() * 2, &left_over);
+			index = find_index(key);
+		}
+		return std::make_pair(index, true);
+	}
+
+public:
+	typedef FlatIterator<Slot, Slot*> iterator;
+	typedef FlatIterator<Slot, const Slot*> const_iterator;
+
+	FlatTable() {
+		number_of_elements = 0;
+		shift = 64;
+	}
+
+	iterator begin() {
+		return iterator(slots.data(), distances.data(), 0, slots.size());
+	}
+
+	iterator end() {
+		return iterator(slots.data(), distances.data(), slots.size(), slots.size());
+	}
+
+	const_iterator begin() const {
+		return const_iterator(slots.data(), distances.data(), 0, slots.size());
+	}
+
+	const_iterator end() const {
+		return const_iterator(slots.data(), distances.data(), slots.size(), slots.size());
+	}
+
+	template <class K>
+	iterator find(const K& key) {
+		size_t index = find_index(key);
+		return iterator(slots.data(), distances.data(), index == NOT_FOUND ? slots.size() : index, slots.size());
+	}
+
+	template <class K>
+	const_iterator find(const K& key) const {
+		size_t index = find_index(key);
+		return const_iterator(slots.data(), distances.data(), index == NOT_FOUND ? slots.size() : index, slots.size());
+	}
+
+	template <class K>
+	size_t count(const K& key) const {
+		return find_index(key) == NOT_FOUND ? 0 : 1;
+	}
+
+	size_t size() const {
+		return number_of_elements;
+	}
+
+	bool empty() const {
+		return number_of_elements == 0;
+	}
+
+	// makes room for the given number of elements, so inserting them won't rehash.
+	void reserve(size_t elements) {
+		grow_for(elements);
+	}
+
+	void clear() {
+		slots.clear();
+		distances.clear();
+		number_of_elements = 0;
+		shift = 64;
+	}
+
+	/*
+	 * Removes the element, and moves the following elements of the probe sequence one
+	 * slot back (until an empty slot or an element at it's home), so there are no
+	 * holes in the probe sequences.
+	 */
+	void erase(iterator position) {
+		size_t mask = slots.size() - 1;
+		size_t index = position.get_index();
+		while (true) {
+			size_t next = (index + 1) & mask;
+			if (distances[next] <= 1) {
+				distances[index] = 0;
+				slots[index] = Slot();
+				break;
+			}
+			slots[index] = std::move(slots[next]);
+			distances[index] = distances[next] - 1;
+			index = next;
+		}
+		number_of_elements--;
+	}
+
+	template <class K>
+	size_t erase(const K& key) {
+		iterator position = find(key);
+		if (position == end()) {
+			return 0;
+		}
+		erase(position);
+		return 1;
+	}
+
+	// the number of slots, the counterpart of unordered_map::bucket_count.
+	size_t bucket_count() const {
+		return slots.size();
+	}
+
+	// the bytes allocated by the table (not counting what the elements allocate).
+	size_t memory_usage() const {
+		return slots.capacity() * sizeof(Slot) + distances.capacity();
+	}
+};
+
+template <class Key, class Value, class Hash = FlatHash<Key>>
+class FlatHashMap : public FlatTable<Key, std::pair<Key, Value>, FlatMapKey, Hash> {
+	typedef FlatTable<Key, std::pair<Key, Value>, FlatMapKey, Hash> Table;
+public:
+	typedef typename Table::iterator iterator;
+	typedef typename Table::const_iterator const_iterator;
+
+	Value& operator[](const Key& key) {
+		size_t index = this->find_or_insert(key, [&key]() { return std::pair<Key, Value>(key, Value()); }).first;
+		return this->slots[index].second;
+	}
+
+	Value& at(const Key& key) {
+		size_t index = this->find_index(key);
+		if (index == Table::NOT_FOUND) {
+			throw std::out_of_range("FlatHashMap::at");
+		}
+		return this->slots[index].second;
+	}
+
+	std::pair<iterator, bool> insert(const std::pair<Key, Value>& element) {
+		std::pair<size_t, bool> result = this->find_or_insert(element.first, [&element]() { return element; });
+		return std::make_pair(iterator(this->slots.data(), this->distances.data(), result.first, this->slots.size()), result.second);
+	}
+};
+
+template <class Key, class Hash = FlatHash<Key>>
+class FlatHashSet : public FlatTable<Key, Key, FlatSetKey, Hash> {
+	typedef FlatTable<Key, Key, FlatSetKey, Hash> Table;
+public:
+	typedef typename Table::iterator iterator;
+	typedef typename Table::const_iterator const_iterator;
+
+	std::pair<iterator, bool> insert(const Key& key) {
+		std::pair<size_t, bool> result = this->find_or_insert(key, [&key]() { return key; });
+		return std::make_pair(iterator(this->slots.data(), this->distances.data(), result.first, this->slots.size()), result.second);
+	}
+
+	template <class InputIterator>
+	void insert(InputIterator first, InputIterator last) {
+		for (; first != last; ++first) {
+			insert(*first);
+		}
+	}
+};
@@ -0,0 +1,426 @@
+// frozen_dictionary.h : Read-only dictionaries (words of exercise 1, authors of
+// exercise 2) saved by a run and loaded by the later runs on the same data.
+//
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstring>
+#include <cstddef>
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/*
+ * Once the whole file has been read, the dictionary does not change any more, so it
+ * does not need a hash table which can grow, and it does not need a lock. A frozen
+ * dictionary is a minimal perfect hash function (every key gets a different number
+ * from 0 to n - 1, with no empty slots) and the keys in the order of these numbers.
+ *
+ * The perfect hash is built in levels (like BBHash): every key is hashed to a bit of
+ * the first level, which has 1.5 bits for every key. The bits which got exactly one
+ * key are set, and the keys which collided with an other key go on to the next level,
+ * which has 1.5 bits for every key left, and so on. A key is in the first level where
+ * it's bit is set, and it's number is the number of set bits before it's own bit (over
+ * all the levels), which comes from the rank table (the set bits before every 512 bits)
+ * and at most 8 words of the bit array. About half of the keys get a bit of their own
+ * in every level, so there are about 2.9 bits per key in the levels, 3.3 with the rank
+ * table, and a lookup looks at two levels on average.
+ *
+ * A key which is not in the dictionary also gets a number (or falls off the last
+ * level). Every key has an entry of 64 bits, the offset of it's bytes in the key store
+ * (40 bits) and a 24 bit fingerprint of it's hash, so an unknown key is rejected by the
+ * entry (one more cache miss), and only a known key (or one in 16 million unknown
+ * ones) is compared with the key store. The entries used to have the first 8 bytes of
+ * the key too, which saved the key store read of the short keys, but the words of
+ * RC_a (2.1 million keys, 5 bytes on average) took 176 bits per key that way, and now
+ * take 112, with about the same lookup times (400 ns for a known or an unknown key
+ * in random order, which is all cache misses, on a laptop).
+ *
+ * The file is the header, the levels, the rank table, the entries and the key bytes,
+ * every part as 64 bit words, so it can be mapped into the memory as it is, and a
+ * lookup reads the mapped pages directly. A corrupt or truncated file must not make
+ * a lookup read outside of the mapping, so loading it checks that the sizes of the
+ * parts add up to the size of the file, that the rank table is right and the levels
+ * have exactly one bit for every key (so every number is a key's), and that the
+ * entries go through the key store in order. That reads the levels and the entries
+ * once, about 9 bytes per key, not the keys themselves.
+ */
+class FrozenDictionary {
+	static const int MAX_LEVELS = 64;
+	static const int OFFSET_BITS = 40;
+	static const int HEADER_WORDS = 8;
+
+	// the file mapped into the memory.
+	const char* data;
+	size_t data_size;
+#ifdef _WIN32
+	HANDLE file;
+	HANDLE mapping;
+#endif
+
+	unsigned long long number_of_keys;
+	// the first word and the number of words of every level in bits.
+	std::vector<unsigned long long> level_begin;
+	std::vector<unsigned long long> level_words;
+	const unsigned long long* bits;
+	const unsigned long long* ranks;
+	// a word for every key (and one more for the end of the last one): the offset of
+	// the key in the key store, with the fingerprint in the upper 24 bits.
+	const unsigned long long* entries;
+	const char* key_bytes;
+
+	static const char* magic() {
+		return "bigdata-challenge-2 frozen dict2";
+	}
+
+	// two independent hashes of the key (FNV-1a with different starting values, and
+	// splitmix64 over them), together they are practically never the same for two keys.
+	static void hash_bytes(const char* key, size_t size, unsigned long long& hash1, unsigned long long& hash2) {
+		hash1 = 14695981039346656037ULL;
+		hash2 = 14695981039346656037ULL ^ 0x5851F42D4C957F2DULL;
+		for (size_t i = 0; i < size; ++i) {
+			hash1 = (hash1 ^ (unsigned char)key[i]) * 1099511628211ULL;
+			hash2 = (hash2 ^ (unsigned char)key[i]) * 1099511628211ULL;
+		}
+		hash1 = mix(hash1);
+		hash2 = mix(hash2);
+	}
+
+	static unsigned long long mix(unsigned long long x) {
+		x += 0x9E3779B97F4A7C15ULL;
+		x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+		return x ^ (x >> 31);
+	}
+
+	// the bit of the key in a level with the given number of bits (less than 2^32). The
+	// upper 32 bits of the hash are scaled to the size with a multiplication, which is
+	// much faster than a division.
+	static unsigned long long position(unsigned long long hash1, unsigned long long hash2, int level, unsigned long long size) {
+		return ((mix(hash1 + hash2 * (level + 1)) >> 32) * size) >> 32;
+	}
+
+	static unsigned long long fingerprint(unsigned long long hash2) {
+		return hash2 >> OFFSET_BITS;
+	}
+
+	static int popcount(unsigned long long x) {
+		x = x - ((x >> 1) & 0x5555555555555555ULL);
+		x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+		x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+		return (int)((x * 0x0101010101010101ULL) >> 56);
+	}
+
+	static unsigned long long words_for(unsigned long long bytes) {
+		return (bytes + 7) / 8;
+	}
+
+	static unsigned long long offset_of(unsigned long long entry) {
+		return entry & ((1ULL << OFFSET_BITS) - 1);
+	}
+
+	void unmap() {
+		if (data == nullptr) {
+			return;
+		}
+#ifdef _WIN32
+		UnmapViewOfFile(data);
+		CloseHandle(mapping);
+		CloseHandle(file);
+#else
+		munmap((void*)data, data_size);
+#endif
+		data = nullptr;
+		data_size = 0;
+		number_of_keys = 0;
+		level_begin.clear();
+		level_words.clear();
+	}
+
+	// maps the whole file into the memory (read-only), returns false if it can't.
+	bool map_file(const std::string& path) {
+#ifdef _WIN32
+		file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (file == INVALID_HANDLE_VALUE) {
+			return false;
+		}
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+			CloseHandle(file);
+			return false;
+		}
+		mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (mapping == nullptr) {
+			CloseHandle(file);
+			return false;
+		}
+		data = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		if (data == nullptr) {
+			CloseHandle(mapping);
+			CloseHandle(file);
+			return false;
+		}
+		data_size = (size_t)size.QuadPart;
+#else
+		int fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0) {
+			return false;
+		}
+		struct stat info;
+		if (fstat(fd, &info) != 0 || info.st_size == 0) {
+			close(fd);
+			return false;
+		}
+		void* mapped = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		// the mapping stays valid after the file is closed.
+		close(fd);
+		if (mapped == MAP_FAILED) {
+			return false;
+		}
+		data = (const char*)mapped;
+		data_size = info.st_size;
+#endif
+		return true;
+	}
+
+public:
+	FrozenDictionary() {
+		data = nullptr;
+		data_size = 0;
+		number_of_keys = 0;
+		bits = nullptr;
+		ranks = nullptr;
+		entries = nullptr;
+		key_bytes = nullptr;
+	}
+
+	~FrozenDictionary() {
+		unmap();
+	}
+
+	FrozenDictionary(const FrozenDictionary&) = delete;
+	FrozenDictionary& operator=(const FrozenDictionary&) = delete;
+
+	/*
+	 * Builds the dictionary of the keys (which have to be different) and writes it to
+	 * the file. The number of a key in the dictionary is not it's index in keys.
+	 */
+	static bool write(const std::string& path, const std::vector<std::string>& keys) {
+		std::vector<unsigned long long> hash1(keys.size()), hash2(keys.size());
+		unsigned long long total_bytes = 0;
+		for (size_t i = 0; i < keys.size(); ++i) {
+			hash_bytes(keys[i].data(), keys[i].size(), hash1[i], hash2[i]);
+			total_bytes += keys[i].size();
+		}
+		if (total_bytes >> OFFSET_BITS != 0 || keys.size() >= (1ULL << 31)) {
+			return false;
+		}
+
+		// the levels, and the level and bit of every key.
+		std::vector<std::vector<unsigned long long>> levels;
+		std::vector<int> key_level(keys.size());
+		std::vector<unsigned long long> key_bit(keys.size());
+		std::vector<size_t> remaining(keys.size());
+		for (size_t i = 0; i < keys.size(); ++i) {
+			remaining[i] = i;
+		}
+		while (!remaining.empty()) {
+			int level = (int)levels.size();
+			if (level == MAX_LEVELS) {
+				return false;
+			}
+			unsigned long long words = (remaining.size() * 3 / 2 + 63) / 64;
+			std::vector<unsigned long long> taken(words, 0), collided(words, 0);
+			for (const auto& key : remaining) {
+				unsigned long long bit = position(hash1[key], hash2[key], level, words * 64);
+				if (taken[bit / 64] & (1ULL << (bit % 64))) {
+					collided[bit / 64] |= 1ULL << (bit % 64);
+				}
+				taken[bit / 64] |= 1ULL << (bit % 64);
+			}
+			std::vector<size_t> next;
+			for (const auto& key : remaining) {
+				unsigned long long bit = position(hash1[key], hash2[key], level, words * 64);
+				if (collided[bit / 64] & (1ULL << (bit % 64))) {
+					next.push_back(key);
+				}
+				else {
+					key_level[key] = level;
+					key_bit[key] = bit;
+				}
+			}
+			for (unsigned long long i = 0; i < words; ++i) {
+				taken[i] &= ~collided[i];
+			}
+			levels.push_back(taken);
+			remaining.swap(next);
+		}
+
+		// the levels one after the other, and the rank table.
+		std::vector<unsigned long long> all_bits, all_ranks, begin;
+		for (const auto& level : levels) {
+			begin.push_back(all_bits.size());
+			all_bits.insert(all_bits.end(), level.begin(), level.end());
+		}
+		unsigned long long rank = 0;
+		for (size_t i = 0; i < all_bits.size(); ++i) {
+			if (i % 8 == 0) {
+				all_ranks.push_back(rank);
+			}
+			rank += popcount(all_bits[i]);
+		}
+
+		// the number of every key, and the keys in that order.
+		std::vector<size_t> by_number(keys.size());
+		for (size_t i = 0; i < keys.size(); ++i) {
+			unsigned long long word = begin[key_level[i]] + key_bit[i] / 64;
+			unsigned long long number = all_ranks[word / 8];
+			for (unsigned long long w = word / 8 * 8; w < word; ++w) {
+				number += popcount(all_bits[w]);
+			}
+			number += popcount(all_bits[word] & ((1ULL << (key_bit[i] % 64)) - 1));
+			by_number[number] = i;
+		}
+		std::vector<unsigned long long> all_entries;
+		unsigned long long offset = 0;
+		for (const auto& key : by_number) {
+			all_entries.push_back(offset | (fingerprint(hash2[key]) << OFFSET_BITS));
+			offset += keys[key].size();
+		}
+		all_entries.push_back(offset);
+
+		std::ofstream out(path, std::ios::binary);
+		char header_magic[32] = {};
+		memcpy(header_magic, magic(), 32);
+		out.write(header_magic, 32);
+		unsigned long long header[HEADER_WORDS - 4] = { keys.size(), levels.size(), all_bits.size(), total_bytes };
+		out.write((const char*)header, sizeof(header));
+		for (const auto& level : levels) {
+			unsigned long long words = level.size();
+			out.write((const char*)&words, sizeof(words));
+		}
+		out.write((const char*)all_bits.data(), all_bits.size() * 8);
+		out.write((const char*)all_ranks.data(), all_ranks.size() * 8);
+		out.write((const char*)all_entries.data(), all_entries.size() * 8);
+		for (const auto& key : by_number) {
+			out.write(keys[key].data(), keys[key].size());
+		}
+		std::vector<char> padding(words_for(total_bytes) * 8 - total_bytes, 0);
+		out.write(padding.data(), padding.size());
+		return out.good();
+	}
+
+	/*
+	 * Maps the file into the memory, and checks it (see above). Returns false if it's
+	 * not a frozen dictionary, or a broken one.
+	 */
+	bool load(const std::string& path) {
+		unmap();
+		if (!map_file(path)) {
+			return false;
+		}
+		const unsigned long long* words = (const unsigned long long*)data;
+		unsigned long long size = data_size / 8;
+		if (data_size % 8 != 0 || size < HEADER_WORDS || memcmp(data, magic(), 32) != 0 || words[5] > MAX_LEVELS || size < HEADER_WORDS + words[5]) {
+			unmap();
+			return false;
+		}
+		number_of_keys = words[4];
+		unsigned long long number_of_levels = words[5];
+		unsigned long long number_of_words = words[6];
+		unsigned long long total_bytes = words[7];
+		// the sizes come from the file, so they are checked one by one before they are
+		// added up, a huge one could overflow the sum.
+		unsigned long long begin = 0;
+		bool ok = number_of_words <= size && number_of_keys <= size && total_bytes >> OFFSET_BITS == 0;
+		for (unsigned long long i = 0; i < number_of_levels && ok; ++i) {
+			unsigned long long level_size = words[HEADER_WORDS + i];
+			ok = level_size > 0 && level_size <= size;
+			level_begin.push_back(begin);
+			level_words.push_back(level_size);
+			begin += level_size;
+		}
+		unsigned long long number_of_ranks = (number_of_words + 7) / 8;
+		if (!ok || begin != number_of_words || size != HEADER_WORDS + number_of_levels + number_of_words + number_of_ranks + (number_of_keys + 1) + words_for(total_bytes)) {
+			unmap();
+			return false;
+		}
+		bits = words + HEADER_WORDS + number_of_levels;
+		ranks = bits + number_of_words;
+		entries = ranks + number_of_ranks;
+		key_bytes = (const char*)(entries + number_of_keys + 1);
+		unsigned long long rank = 0;
+		for (unsigned long long i = 0; i < number_of_words && ok; ++i) {
+			ok = i % 8 != 0 || ranks[i / 8] == rank;
+			rank += popcount(bits[i]);
+		}
+		ok = ok && rank == number_of_keys && offset_of(entries[0]) == 0 && entries[number_of_keys] == total_bytes;
+		for (unsigned long long i = 0; i < number_of_keys && ok; ++i) {
+			ok = offset_of(entries[i]) <= offset_of(entries[i + 1]);
+		}
+		if (!ok) {
+			unmap();
+			return false;
+		}
+		return true;
+	}
+
+	// the number of the key (from 0), or -1 if it's not in the dictionary.
+	long long find(const char* key, size_t size) const {
+		if (number_of_keys == 0) {
+			return -1;
+		}
+		unsigned long long hash1, hash2;
+		hash_bytes(key, size, hash1, hash2);
+		for (size_t level = 0; level < level_words.size(); ++level) {
+			unsigned long long bit = position(hash1, hash2, (int)level, level_words[level] * 64);
+			unsigned long long word = level_begin[level] + bit / 64;
+			unsigned long long mask = 1ULL << (bit % 64);
+			if ((bits[word] & mask) == 0) {
+				continue;
+			}
+			unsigned long long number = ranks[word / 8];
+			for (unsigned long long w = word / 8 * 8; w < word; ++w) {
+				number += popcount(bits[w]);
+			}
+			number += popcount(bits[word] & (mask - 1));
+			unsigned long long offset = offset_of(entries[number]);
+			unsigned long long end = offset_of(entries[number + 1]);
+			if (entries[number] >> OFFSET_BITS != fingerprint(hash2) || end - offset != size || memcmp(key_bytes + offset, key, size) != 0) {
+				return -1;
+			}
+			return (long long)number;
+		}
+		return -1;
+	}
+
+	long long find(const std::string& key) const {
+		return find(key.data(), key.size());
+	}
+
+	std::string key(unsigned long long number) const {
+		unsigned long long offset = offset_of(entries[number]);
+		unsigned long long end = offset_of(entries[number + 1]);
+		return std::string(key_bytes + offset, end - offset);
+	}
+
+	size_t size() const {
+		return (size_t)number_of_keys;
+	}
+
+	// the bytes of the mapped file (only the pages which are used are in the memory).
+	size_t memory_usage() const {
+		return data_size;
+	}
+};
@@ -0,0 +1,718 @@
+// input_reader.h : The input of all three programs: the list of input files, the
+// block indexes and filters of the lines, and the reader shared by the threads.
+//
+
+#pragma once
+
+#include "flat_hash.h"
+#include "binary_io.h"
+#include <string>
+#include <vector>
+#include <map>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <climits>
+#include <cctype>
+#include <cstdlib>
+#include <cstdio>
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+/*
+ * The input can be several files (the dumps are one file per month). Every --input is
+ * a file, a directory (every file in it), or a pattern with * and ? in the file name
+ * (e.g. reddit/RC_2015-*). matches tells whether a file name matches such a pattern.
+ */
+inline bool matches(const char* pattern, const char* name) {
+	if (*pattern == '\0') {
+		return *name == '\0';
+	}
+	if (*pattern == '*') {
+		return matches(pattern + 1, name) || (*name != '\0' && matches(pattern, name + 1));
+	}
+	return *name != '\0' && (*pattern == '?' || *pattern == *name) && matches(pattern + 1, name + 1);
+}
+
+inline bool is_directory(std::string path) {
+#ifdef _WIN32
+	DWORD attributes = GetFileAttributesA(path.c_str());
+	return attributes != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+#else
+	struct stat info;
+	return stat(path.c_str(), &info) == 0 && S_ISDIR(info.st_mode);
+#endif
+}
+
+// the names of the files in a directory (without the subdirectories), sorted.
+inline std::vector<std::string> list_directory(std::string directory) {
+	std::vector<std::string> names;
+#ifdef _WIN32
+	WIN32_FIND_DATAA data;
+	HANDLE handle = FindFirstFileA((directory + "\\*").c_str(), &data);
+	if (handle != INVALID_HANDLE_VALUE) {
+		do {
+			if ((data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) == 0) {
+				names.push_back(data.cFileName);
+			}
+		} while (FindNextFileA(handle, &data));
+		FindClose(handle);
+	}
+#else
+	DIR* dir = opendir(directory.c_str());
+	if (dir != nullptr) {
+		for (dirent* entry = readdir(dir); entry != nullptr; entry = readdir(dir)) {
+			if (!is_directory(directory + "/" + entry->d_name)) {
+				names.push_back(entry->d_name);
+			}
+		}
+		closedir(dir);
+	}
+#endif
+	std::sort(names.begin(), names.end());
+	return names;
+}
+
+// the block indexes (see build_index) are next to the input files, but they are not input.
+inline bool is_block_index(const std::string& name) {
+	return name.size() > 4 && name.compare(name.size() - 4, 4, ".idx") == 0;
+}
+
+// adds the files of one --input to the list, returns false if there was none (a block
+// index given as an input is skipped).
+inline bool expand_input(std::string input, std::vector<std::string>& files) {
+	size_t found = files.size();
+	size_t separator = input.find_last_of("/\\");
+	std::string directory = separator == std::string::npos ? "" : input.substr(0, separator + 1);
+	std::string pattern = input.substr(directory.size());
+	if (is_directory(input)) {
+		if (input.back() != '/' && input.back() != '\\') {
+			input += "/";
+		}
+		for (const auto& name : list_directory(input)) {
+			if (!is_block_index(name)) {
+				files.push_back(input + name);
+			}
+		}
+	}
+	else if (pattern.find_first_of("*?") != std::string::npos) {
+		for (const auto& name : list_directory(directory.empty() ? "." : directory)) {
+			if (matches(pattern.c_str(), name.c_str()) && !is_block_index(name)) {
+				files.push_back(directory + name);
+			}
+		}
+	}
+	else if (is_block_index(input)) {
+		// e.g. the shell expanded RC_* to the indexes too, the other inputs are the
+		// files. If there are no others, main stops with "no input files".
+		std::cout << "skipping " << input << ", it's a block index, not an input file" << std::endl;
+		return true;
+	}
+	else if (std::ifstream(input).is_open()) {
+		files.push_back(input);
+	}
+	return files.size() > found;
+}
+
+inline long long get_file_size(std::string path) {
+	std::ifstream input(path, std::ios::binary | std::ios::ate);
+	return input.is_open() ? (long long)input.tellg() : 0;
+}
+
+/*
+ * A part of an input file: the lines starting in the [begin, end) byte range. If begin
+ * is in the middle of a line, that line belongs to the previous range.
+ */
+class FileRange {
+public:
+	int file;
+	long long begin;
+	long long end;
+
+	FileRange(int file_in, long long begin_in, long long end_in) {
+		file = file_in;
+		begin = begin_in;
+		end = end_in;
+	}
+};
+
+/*
+ * Sharding: with --shard i/n the input is divided into n byte ranges of the same size
+ * (counting the files one after the other), and the process only reads the i-th
+ * (starting from 0). Several processes can then work on the same input, each writing
+ * it's partial result with --map, and one process merges the partials with --reduce.
+ * Returns the parts of the files in the shard (every file without sharding).
+ */
+inline std::vector<FileRange> get_file_ranges(std::vector<std::string>& files, int shard, int shards) {
+	std::vector<long long> sizes;
+	long long total = 0;
+	for (const auto& file : files) {
+		sizes.push_back(get_file_size(file));
+		total += sizes.back();
+	}
+	long long begin = total * shard / shards;
+	long long end = total * (shard + 1) / shards;
+	std::vector<FileRange> ranges;
+	long long offset = 0;
+	for (size_t i = 0; i < files.size(); ++i) {
+		long long file_begin = std::max(begin - offset, 0LL);
+		long long file_end = std::min(end - offset, sizes[i]);
+		if (file_begin < file_end) {
+			ranges.push_back(FileRange(i, file_begin, file_end));
+		}
+		offset += sizes[i];
+	}
+	return ranges;
+}
+
+/*
+ * Block index: an optional sidecar file next to every input file (<file>.idx, built
+ * with --build-index), which summarises every INDEX_BLOCK bytes of the file: the
+ * number of lines starting in the block, the smallest and largest created_utc of
+ * them, and a bloom filter of their subreddits (lowercase). With --subreddit, --since
+ * or --until the readers look at the index first, and skip the blocks which can not
+ * have a matching line, without reading them at all.
+ * The bloom filter has INDEX_BLOOM_BITS bits and INDEX_BLOOM_HASHES bits are set for
+ * every subreddit. A block has about a thousand subreddits, so a subreddit which is
+ * not in the block still matches it with a probability of about 3%.
+ */
+const long long INDEX_BLOCK = 1 << 20;
+const int INDEX_BLOOM_BITS = 8192;
+const int INDEX_BLOOM_HASHES = 3;
+const std::string INDEX_MAGIC = "bigdata-challenge-2 block index v1";
+
+inline std::string index_path(std::string file) {
+	return file + ".idx";
+}
+
+// the names of the subreddits are compared in lowercase, AskReddit is askreddit.
+inline std::string to_lowercase(std::string s) {
+	for (size_t i = 0; i < s.size(); ++i) {
+		s[i] = tolower(s[i]);
+	}
+	return s;
+}
+
+/*
+ * Finds the value of a field in the raw json line, without parsing the line. Only a
+ * key of the comment is found (which comes after a { or a ,), not the same text in
+ * the body, where the quotes are escaped. The value is returned without the quotes
+ * (created_utc is a string in the older dumps).
+ */
+inline bool find_field(const std::string& line, const std::string& name, std::string& value) {
+	std::string key = "\"" + name + "\"";
+	for (size_t found = line.find(key); found != std::string::npos; found = line.find(key, found + 1)) {
+		size_t before = found > 0 ? line.find_last_not_of(" \t", found - 1) : std::string::npos;
+		if (before == std::string::npos || (line[before] != '{' && line[before] != ',')) {
+			continue;
+		}
+		size_t colon = line.find_first_not_of(" \t", found + key.size());
+		if (colon == std::string::npos || line[colon] != ':') {
+			continue;
+		}
+		size_t begin = line.find_first_not_of(" \t", colon + 1);
+		if (begin == std::string::npos) {
+			return false;
+		}
+		size_t end;
+		if (line[begin] == '"') {
+			begin++;
+			end = line.find('"', begin);
+		}
+		else {
+			end = line.find_first_of(",} \t", begin);
+		}
+		if (end == std::string::npos) {
+			return false;
+		}
+		value = line.substr(begin, end - begin);
+		return true;
+	}
+	return false;
+}
+
+class BlockSummary {
+public:
+	long lines;
+	long long min_created_utc;
+	long long max_created_utc;
+	std::vector<unsigned char> bloom;
+
+	BlockSummary() {
+		lines = 0;
+		min_created_utc = LLONG_MAX;
+		max_created_utc = LLONG_MIN;
+		bloom.assign(INDEX_BLOOM_BITS / 8, 0);
+	}
+
+	// the bits of a subreddit, from two halves of it's hash (double hashing).
+	static int bloom_bit(const std::string& subreddit, int i) {
+		unsigned long long hash = flat_hash_bytes(subreddit.data(), subreddit.size());
+		unsigned long long step = (hash >> 32) | 1;
+		return (int)((hash + i * step) % INDEX_BLOOM_BITS);
+	}
+
+	void add(const std::string& subreddit, long long created_utc) {
+		lines++;
+		min_created_utc = std::min(min_created_utc, created_utc);
+		max_created_utc = std::max(max_created_utc, created_utc);
+		for (int i = 0; i < INDEX_BLOOM_HASHES; ++i) {
+			int bit = bloom_bit(subreddit, i);
+			bloom[bit / 8] |= 1 << (bit % 8);
+		}
+	}
+
+	bool may_contain(const std::string& subreddit) {
+		for (int i = 0; i < INDEX_BLOOM_HASHES; ++i) {
+			int bit = bloom_bit(subreddit, i);
+			if ((bloom[bit / 8] & (1 << (bit % 8))) == 0) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// an empty block only stores it's number of lines.
+	void write(std::ostream& out) {
+		write_varint(out, lines);
+		if (lines > 0) {
+			write_varint(out, min_created_utc);
+			write_varint(out, max_created_utc);
+			out.write((const char*)bloom.data(), bloom.size());
+		}
+	}
+
+	void read(std::istream& in) {
+		lines = read_varint(in);
+		if (lines > 0) {
+			min_created_utc = read_varint(in);
+			max_created_utc = read_varint(in);
+			in.read((char*)bloom.data(), bloom.size());
+		}
+	}
+};
+
+/*
+ * The index of a file starts with the size of the file, the block size and the size of
+ * the bloom filters, so an index which does not fit the file (or the program) any more
+ * is not used. Then comes the summary of every block.
+ */
+inline bool write_index(std::string path, long long file_size, std::vector<BlockSummary>& blocks) {
+	std::ofstream out(path, std::ios::binary);
+	write_string(out, INDEX_MAGIC);
+	write_varint(out, file_size);
+	write_varint(out, INDEX_BLOCK);
+	write_varint(out, INDEX_BLOOM_BITS);
+	write_varint(out, blocks.size());
+	for (auto& block : blocks) {
+		block.write(out);
+	}
+	return out.good();
+}
+
+/*
+ * Reads a date of --since or --until, either YYYY-MM-DD (UTC) or a unix timestamp. A
+ * day is the start of the day, or the end of it if end_of_day is true, so --until
+ * includes the last day. The days are counted from 1970-01-01 with Howard Hinnant's
+ * days_from_civil algorithm (march is the first month of the year, so the leap day is
+ * at the end).
+ */
+inline bool parse_date(std::string text, bool end_of_day, long long& created_utc) {
+	int year, month, day;
+	char rest;
+	if (std::sscanf(text.c_str(), "%d-%d-%d%c", &year, &month, &day, &rest) == 3) {
+		if (month < 1 || month > 12 || day < 1 || day > 31) {
+			return false;
+		}
+		year -= month <= 2;
+		long long era = (year >= 0 ? year : year - 399) / 400;
+		long long year_of_era = year - era * 400;
+		long long day_of_year = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+		long long day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+		created_utc = (era * 146097 + day_of_era - 719468) * 86400 + (end_of_day ? 86399 : 0);
+		return true;
+	}
+	char* end;
+	created_utc = std::strtoll(text.c_str(), &end, 10);
+	return !text.empty() && *end == '\0';
+}
+
+/*
+ * The filters of --subreddit, --since and --until. The readers check every line with
+ * accepts before giving it to the threads, so the threads never see the other lines.
+ * This only searches the subreddit and created_utc fields in the raw text, so the
+ * lines which are left out are not parsed. skip_blocks uses the block indexes to
+ * leave out the blocks where there is nothing to accept.
+ */
+class LineFilter {
+	FlatHashSet<std::string> subreddits;
+	long long since;
+	long long until;
+public:
+	LineFilter() {
+		since = LLONG_MIN;
+		until = LLONG_MAX;
+	}
+
+	void add_subreddit(std::string subreddit) {
+		subreddits.insert(to_lowercase(subreddit));
+	}
+
+	// only the comments created in [since, until] are accepted.
+	void set_time_range(long long since_in, long long until_in) {
+		since = since_in;
+		until = until_in;
+	}
+
+	bool is_active() {
+		return !subreddits.empty() || since != LLONG_MIN || until != LLONG_MAX;
+	}
+
+	bool accepts(const std::string& line) {
+		std::string value;
+		if (!subreddits.empty() && (!find_field(line, "subreddit", value) || subreddits.count(to_lowercase(value)) == 0)) {
+			return false;
+		}
+		if (since != LLONG_MIN || until != LLONG_MAX) {
+			if (!find_field(line, "created_utc", value)) {
+				return false;
+			}
+			long long created_utc = atoll(value.c_str());
+			return created_utc >= since && created_utc <= until;
+		}
+		return true;
+	}
+
+	bool may_match(BlockSummary& block) {
+		if (block.lines == 0 || block.max_created_utc < since || block.min_created_utc > until) {
+			return false;
+		}
+		if (subreddits.empty()) {
+			return true;
+		}
+		for (const auto& subreddit : subreddits) {
+			if (block.may_contain(subreddit)) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// which blocks of the file may have a matching line, everything if there is no
+	// (usable) index.
+	std::vector<bool> read_matching_blocks(std::string file, long long file_size) {
+		long long number_of_blocks = (file_size + INDEX_BLOCK - 1) / INDEX_BLOCK;
+		std::ifstream in(index_path(file), std::ios::binary);
+		if (!in.is_open()) {
+			std::cout << "no block index for " << file << ", reading all of it (see --build-index)" << std::endl;
+			return std::vector<bool>(number_of_blocks, true);
+		}
+		if (read_string(in) != INDEX_MAGIC || (long long)read_varint(in) != file_size || read_varint(in) != INDEX_BLOCK
+			|| read_varint(in) != INDEX_BLOOM_BITS || (long long)read_varint(in) != number_of_blocks) {
+			std::cout << "the block index of " << file << " is out of date, reading all of it" << std::endl;
+			return std::vector<bool>(number_of_blocks, true);
+		}
+		std::vector<bool> matching(number_of_blocks);
+		BlockSummary block;
+		for (long long i = 0; i < number_of_blocks && in.good(); ++i) {
+			block.read(in);
+			matching[i] = may_match(block);
+		}
+		if (!in.good()) {
+			std::cout << "the block index of " << file << " is broken, reading all of it" << std::endl;
+			return std::vector<bool>(number_of_blocks, true);
+		}
+		return matching;
+	}
+
+	// cuts the ranges to the blocks which may have a matching line (consecutive blocks
+	// stay together in one range).
+	std::vector<FileRange> skip_blocks(std::vector<std::string>& files, std::vector<FileRange> ranges) {
+		if (!is_active()) {
+			return ranges;
+		}
+		std::map<int, std::vector<bool>> matching;
+		std::vector<FileRange> kept;
+		long long total = 0, read = 0;
+		for (const auto& range : ranges) {
+			if (matching.count(range.file) == 0) {
+				matching[range.file] = read_matching_blocks(files[range.file], get_file_size(files[range.file]));
+			}
+			std::vector<bool>& blocks = matching[range.file];
+			total += range.end - range.begin;
+			for (long long block = range.begin / INDEX_BLOCK; block * INDEX_BLOCK < range.end; ++block) {
+				if (!blocks[block]) {
+					continue;
+				}
+				long long begin = std::max(range.begin, block * INDEX_BLOCK);
+				long long end = std::min(range.end, (block + 1) * INDEX_BLOCK);
+				if (!kept.empty() && kept.back().file == range.file && kept.back().end == begin) {
+					kept.back().end = end;
+				}
+				else {
+					kept.push_back(FileRange(range.file, begin, end));
+				}
+				read += end - begin;
+			}
+		}
+		std::cout << "block index: reading " << read / 1048576.0 << " Mb of " << total / 1048576.0 << " Mb" << std::endl;
+		return kept;
+	}
+};
+
+/*
+ * SharedFileReader is a class responsible of reading in a thread-safe manner from the
+ * input files without leaving out lines, or reading the same twice.
+ * The ranges to read are cut into chunks of at most READ_CHUNK bytes, and the chunks
+ * are handed out to the threads biggest first, so the small files and the ends of the
+ * big ones fill the gaps at the end, and every thread stays busy until the end. Every
+ * thread reads it's own chunk with it's own stream, so they only wait for each other
+ * when they take a new chunk, not for every line.
+ * The progress of every file is printed every 10% (if it has more chunks), and when
+ * it's last chunk is finished, with the throughput.
+ */
+const long long READ_CHUNK = 64 << 20;
+
+class SharedFileReader {
+	// the stream of a thread and the chunk it's reading. reader tells which reader the
+	// cursor belongs to, as a thread has one cursor for all the readers. offset is where
+	// the next line starts, counted by hand (tellg is a call into the stream buffer for
+	// every line).
+	class Cursor {
+	public:
+		long reader;
+		long chunk;
+		int file;
+		long long offset;
+		std::ifstream input;
+
+		Cursor() {
+			reader = 0;
+			chunk = -1;
+			file = -1;
+			offset = 0;
+		}
+	};
+
+	class FileProgress {
+	public:
+		long long size;
+		long long done;
+		int chunks_left;
+		int reported;
+		bool started;
+		std::chrono::steady_clock::time_point start;
+
+		FileProgress() {
+			size = 0;
+			done = 0;
+			chunks_left = 0;
+			reported = 0;
+			started = false;
+		}
+	};
+
+	std::mutex mu_read, mu_write;
+	long id;
+	std::vector<std::string> files;
+	std::vector<FileRange> chunks;
+	size_t next_chunk;
+	std::vector<FileProgress> progress;
+	LineFilter* filter;
+	bool open;
+
+	// counts the chunk as done, and prints the progress of it's file.
+	void finish(FileRange& chunk) {
+		FileProgress& file = progress[chunk.file];
+		file.done += chunk.end - chunk.begin;
+		file.chunks_left--;
+		double seconds = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - file.start).count() / 1000.0;
+		double megabytes = file.done / 1048576.0;
+		double throughput = seconds > 0 ? megabytes / seconds : 0;
+		if (file.chunks_left == 0) {
+			std::cout << "finished " << files[chunk.file] << ": " << megabytes << " Mb in " << seconds << " s (" << throughput << " Mb/s)" << std::endl;
+		}
+		else if (file.done * 10 / file.size > file.reported) {
+			file.reported = file.done * 10 / file.size;
+			std::cout << files[chunk.file] << ": " << file.reported * 10 << "% (" << throughput << " Mb/s)" << std::endl;
+		}
+	}
+
+	// finishes the chunk of the cursor (if any), and gives it the next one.
+	bool next(Cursor& cursor) {
+		{
+			std::lock_guard<std::mutex> locker(mu_read);
+			if (cursor.chunk >= 0) {
+				finish(chunks[cursor.chunk]);
+			}
+			if (next_chunk >= chunks.size()) {
+				cursor.chunk = -1;
+				return false;
+			}
+			cursor.chunk = next_chunk++;
+			FileProgress& file = progress[chunks[cursor.chunk].file];
+			if (!file.started) {
+				file.started = true;
+				file.start = std::chrono::steady_clock::now();
+			}
+		}
+		FileRange& chunk = chunks[cursor.chunk];
+		if (cursor.file != chunk.file) {
+			cursor.input.close();
+			cursor.input.open(files[chunk.file], std::ios::binary);
+			cursor.file = chunk.file;
+		}
+		cursor.input.clear();
+		cursor.input.seekg(chunk.begin > 0 ? chunk.begin - 1 : 0);
+		cursor.offset = 0;
+		if (chunk.begin > 0) {
+			std::string skipped;
+			std::getline(cursor.input, skipped);
+			cursor.offset = chunk.begin + skipped.size();
+		}
+		return true;
+	}
+public:
+	/*
+	 * Reads the given ranges of the files (see get_file_ranges and get_sample_ranges),
+	 * only the lines accepted by the filter, and not the blocks it skips.
+	 */
+	SharedFileReader(std::vector<std::string> files_in, std::vector<FileRange> ranges, LineFilter& filter_in) {
+		static std::atomic<long> readers(0);
+		id = ++readers;
+		files = files_in;
+		filter = &filter_in;
+		ranges = filter->skip_blocks(files, ranges);
+		next_chunk = 0;
+		progress.resize(files.size());
+		for (const auto& range : ranges) {
+			progress[range.file].size += range.end - range.begin;
+			for (long long begin = range.begin; begin < range.end; begin += READ_CHUNK) {
+				chunks.push_back(FileRange(range.file, begin, std::min(range.end, begin + READ_CHUNK)));
+				progress[range.file].chunks_left++;
+			}
+		}
+		std::stable_sort(chunks.begin(), chunks.end(), [](const FileRange& a, const FileRange& b) {
+			return a.end - a.begin > b.end - b.begin;
+		});
+		open = true;
+		for (const auto& file : files) {
+			open = open && std::ifstream(file).is_open();
+		}
+	}
+
+	// can be called by any number of threads at the same time, returns the next line of
+	// the thread's chunk, or of the next chunk.
+	bool shared_read(std::string& line) {
+		int file;
+		long long offset;
+		return shared_read(line, file, offset);
+	}
+
+	// the same, but also tells which file the line is from, and where it starts.
+	bool shared_read(std::string& line, int& file, long long& offset) {
+		static thread_local Cursor cursor;
+		if (cursor.reader != id) {
+			cursor.reader = id;
+			cursor.chunk = -1;
+			cursor.file = -1;
+			cursor.input.close();
+		}
+		while (true) {
+			if (cursor.chunk >= 0) {
+				offset = cursor.offset;
+				if (offset < chunks[cursor.chunk].end && std::getline(cursor.input, line)) {
+					cursor.offset += line.size() + 1;
+					if (filter->accepts(line)) {
+						file = cursor.file;
+						return true;
+					}
+					continue;
+				}
+			}
+			if (!next(cursor)) {
+				return false;
+			}
+		}
+	}
+
+	// whether every file could be opened.
+	bool is_open() {
+		return open;
+	}
+
+	// this is a thread-safe print, just for debugging purposes.
+	void shared_print(std::string line) {
+		std::lock_guard<std::mutex> locker2(mu_write);
+		std::cout << line << std::endl;
+	}
+
+
+};
+
+/*
+ * Builds the block index of every input file (--build-index). The threads read the
+ * files like in a normal run, and add every line to the summary of the block where it
+ * starts. READ_CHUNK is a multiple of INDEX_BLOCK, so a block is always read by one
+ * thread, and the summaries need no lock.
+ */
+inline void do_index_work(SharedFileReader& reader, std::vector<std::vector<BlockSummary>>& indexes) {
+	std::string line, subreddit, created_utc;
+	int file;
+	long long offset;
+	while (reader.shared_read(line, file, offset)) {
+		if (find_field(line, "subreddit", subreddit) && find_field(line, "created_utc", created_utc)) {
+			indexes[file][offset / INDEX_BLOCK].add(to_lowercase(subreddit), atoll(created_utc.c_str()));
+		}
+	}
+}
+
+inline bool build_index(std::vector<std::string>& files) {
+	LineFilter everything;
+	SharedFileReader file_reader(files, get_file_ranges(files, 0, 1), everything);
+	if (!file_reader.is_open()) {
+		std::cout << "error: could not open the input files" << std::endl;
+		return false;
+	}
+	std::vector<std::vector<BlockSummary>> indexes(files.size());
+	for (size_t i = 0; i < files.size(); ++i) {
+		indexes[i].resize((get_file_size(files[i]) + INDEX_BLOCK - 1) / INDEX_BLOCK);
+	}
+	std::thread t1(do_index_work, std::ref(file_reader), std::ref(indexes));
+	std::thread t2(do_index_work, std::ref(file_reader), std::ref(indexes));
+	std::thread t3(do_index_work, std::ref(file_reader), std::ref(indexes));
+	std::thread t4(do_index_work, std::ref(file_reader), std::ref(indexes));
+	std::thread t5(do_index_work, std::ref(file_reader), std::ref(indexes));
+	std::thread t6(do_index_work, std::ref(file_reader), std::ref(indexes));
+	std::thread t7(do_index_work, std::ref(file_reader), std::ref(indexes));
+	std::thread t8(do_index_work, std::ref(file_reader), std::ref(indexes));
+	t1.join();
+	t2.join();
+	t3.join();
+	t4.join();
+	t5.join();
+	t6.join();
+	t7.join();
+	t8.join();
+	for (size_t i = 0; i < files.size(); ++i) {
+		if (!write_index(index_path(files[i]), get_file_size(files[i]), indexes[i])) {
+			std::cout << "error: could not write " << index_path(files[i]) << std::endl;
+			return false;
+		}
+		std::cout << "wrote " << index_path(files[i]) << " (" << indexes[i].size() << " blocks)" << std::endl;
+	}
+	return true;
+}
+
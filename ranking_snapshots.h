@@ -0,0 +1,96 @@
+// ranking_snapshots.h : Snapshots of the current top list while the file is still
+// being read (the progressive mode of all three programs).
+//
+
+#pragma once
+
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+/*
+ * The workers keep a running top list while they read the file (under the lock they
+ * hold for their own data anyway), and a printer thread prints it at every interval
+ * without taking that lock, so the workers never wait for the printer.
+ *
+ * There are two buffers and an epoch, the number of snapshots published so far. The
+ * front buffer is buffers[epoch % 2]. The printer asks for a snapshot (take), the next
+ * worker updating the list sees the request, copies the list into the back buffer and
+ * increments the epoch (publish), which makes it the front, and the printer reads it.
+ * The printer only asks for the next snapshot after it's done with the front buffer,
+ * and only that request lets a worker write the other buffer again, so the buffer
+ * being read is never written. Publishing is copying a top list, a few entries. When
+ * the workers are done, the final list is published the same way and printed last, so
+ * the last snapshot is the list of the whole input.
+ */
+template <class T>
+class RankingSnapshots {
+	std::vector<T> buffers[2];
+	std::atomic<unsigned long> epoch;
+	std::atomic<bool> requested;
+	std::atomic<bool> finished;
+	// the printer's own: the epoch of the last snapshot it took.
+	unsigned long taken;
+public:
+	RankingSnapshots() {
+		epoch = 0;
+		requested = false;
+		finished = false;
+		taken = 0;
+	}
+
+	// cheap enough to be checked by the workers at every update.
+	bool is_requested() const {
+		return requested.load(std::memory_order_acquire);
+	}
+
+	// only one worker at a time, the caller holds it's own lock.
+	void publish(const std::vector<T>& ranking) {
+		buffers[(epoch.load(std::memory_order_relaxed) + 1) % 2] = ranking;
+		requested.store(false, std::memory_order_relaxed);
+		epoch.fetch_add(1, std::memory_order_release);
+	}
+
+	/*
+	 * The printer's side: asks for a snapshot, and waits at most timeout for a worker to
+	 * publish it. Returns the front buffer, which stays valid until the next call, or
+	 * nullptr if there was no update in time (or the workers have finished).
+	 */
+	const std::vector<T>* take(std::chrono::milliseconds timeout) {
+		unsigned long before = epoch.load(std::memory_order_acquire);
+		requested.store(true, std::memory_order_release);
+		auto deadline = std::chrono::steady_clock::now() + timeout;
+		while (epoch.load(std::memory_order_acquire) == before) {
+			if (finished || std::chrono::steady_clock::now() > deadline) {
+				return nullptr;
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		}
+		taken = before + 1;
+		return &buffers[(before + 1) % 2];
+	}
+
+	// sleeps for the interval, returns false (right away) once the workers have finished.
+	bool wait(std::chrono::milliseconds interval) {
+		auto deadline = std::chrono::steady_clock::now() + interval;
+		while (!finished && std::chrono::steady_clock::now() < deadline) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		}
+		return !finished;
+	}
+
+	// called after the workers are joined, with the final list: publishes it (only the
+	// printer reads the buffers now) and stops the printer.
+	void finish(const std::vector<T>& ranking) {
+		publish(ranking);
+		finished = true;
+	}
+
+	// the printer's side after wait returned false: the final list, or nullptr if the
+	// printer already took it.
+	const std::vector<T>* get_final() {
+		unsigned long last = epoch.load(std::memory_order_acquire);
+		return last == taken ? nullptr : &buffers[last % 2];
+	}
+};
@@ -0,0 +1,167 @@
+// sampling.h : The sampling mode of all three programs (--sample <fraction>): the
+// random blocks of the input, the bootstrap weights and the estimated top lists.
+//
+
+#pragma once
+
+#include "input_reader.h"
+#include <string>
+#include <vector>
+#include <iostream>
+#include <algorithm>
+#include <numeric>
+#include <random>
+#include <cmath>
+
+// splitmix64, used to mix the number of a sampled block with the number of a bootstrap
+// replicate (and in exercise 2 for the MinHash functions and the sketches).
+inline unsigned long long mix(unsigned long long x) {
+	x += 0x9e3779b97f4a7c15ULL;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+	return x ^ (x >> 31);
+}
+
+/*
+ * Instead of the whole input, we read random blocks of SAMPLE_BLOCK bytes which
+ * together make up the given fraction of the files. A block is read like a shard (from
+ * the first line starting in it), so every line belongs to exactly one block, and
+ * reading a block only costs a seek instead of reading everything before it. The
+ * blocks are read in the order of their offset. They are drawn with the given seed
+ * (--seed, DEFAULT_SEED if there is none), so a run can be repeated on the same sample.
+ */
+const long long SAMPLE_BLOCK = 64 << 10;
+const unsigned long long DEFAULT_SEED = 1;
+
+inline std::vector<FileRange> get_sample_ranges(std::vector<std::string>& files, double fraction, unsigned long long seed, double& sampled_fraction) {
+	// every block as (file, number of the block in the file).
+	std::vector<std::pair<int, long long>> blocks;
+	std::vector<long long> sizes;
+	long long total = 0;
+	for (size_t i = 0; i < files.size(); ++i) {
+		sizes.push_back(get_file_size(files[i]));
+		total += sizes.back();
+		for (long long block = 0; block * SAMPLE_BLOCK < sizes.back(); ++block) {
+			blocks.push_back(std::make_pair(i, block));
+		}
+	}
+	std::shuffle(blocks.begin(), blocks.end(), std::mt19937_64(seed));
+	blocks.resize(std::min((long long)blocks.size(), std::max(1LL, std::llround(fraction * blocks.size()))));
+	std::sort(blocks.begin(), blocks.end());
+	std::vector<FileRange> ranges;
+	long long sampled_bytes = 0;
+	for (const auto& block : blocks) {
+		ranges.push_back(FileRange(block.first, block.second * SAMPLE_BLOCK, std::min(sizes[block.first], (block.second + 1) * SAMPLE_BLOCK)));
+		sampled_bytes += ranges.back().end - ranges.back().begin;
+	}
+	sampled_fraction = total > 0 ? (double)sampled_bytes / total : 1;
+	return ranges;
+}
+
+/*
+ * The confidence intervals come from a Poisson bootstrap: every sampled block gets a
+ * random weight from Poisson(1) in each of REPLICATES replicates (this is how many
+ * times the block would be in a resample of the same size, with replacement), every
+ * line of the block counts that many times, and the estimates are computed again with
+ * these weights. The blocks are resampled and not the lines, as the sample was drawn
+ * block by block, and the lines of a block are not independent (the comments of a
+ * thread or an author are often close to each other in the file), resampling them one
+ * by one would make the intervals too narrow. The weight only depends on the block
+ * (it's file and offset, see sample_block) and the replicate, so it does not matter
+ * which thread reads the line, and two equal lines in different blocks get different
+ * weights.
+ */
+const int REPLICATES = 100;
+
+// the number of the sampled block a line is in, from the file and the offset of the
+// line (see SharedFileReader::shared_read).
+inline unsigned long long sample_block(int file, long long offset) {
+	return mix(((unsigned long long)file << 40) ^ (unsigned long long)(offset / SAMPLE_BLOCK));
+}
+
+inline int bootstrap_weight(unsigned long long block, int replicate) {
+	double uniform = (mix(block ^ mix(replicate)) >> 11) * (1.0 / 9007199254740992.0);
+	// inverse of the cumulative distribution function of Poisson(1).
+	double probability = std::exp(-1.0);
+	double cumulative = probability;
+	int weight = 0;
+	while (uniform > cumulative && weight < 20) {
+		weight++;
+		probability /= weight;
+		cumulative += probability;
+	}
+	return weight;
+}
+
+/*
+ * Prints the number best of the estimates, the best last like the other toplists.
+ * estimates[i] belongs to names[i], and replicates[r][i] is the same estimate computed
+ * with the weights of the r-th replicate. The replicates are first moved so that their
+ * mean is the estimate (a resample has fewer distinct values than the sample, so the
+ * replicates of the distinct counts are too small, only their spread is useful), and
+ * their spread is narrowed by sqrt(1 - sampled fraction), as the blocks are sampled
+ * without replacement (reading the whole file leaves no error). The confidence
+ * interval is the middle 95% of the replicates, and an entry keeps it's rank in a
+ * replicate if it's at the same place in the ordering of that replicate.
+ */
+inline void print_sampled_toplist(std::vector<std::string>& names, std::vector<double>& estimates, std::vector<std::vector<double>>& replicates, double sampled_fraction, int number) {
+	double correction = std::sqrt(1 - sampled_fraction);
+	for (size_t i = 0; i < names.size(); ++i) {
+		double mean = 0;
+		for (auto& replicate : replicates) {
+			mean += replicate[i] / replicates.size();
+		}
+		for (auto& replicate : replicates) {
+			replicate[i] = estimates[i] + (replicate[i] - mean) * correction;
+		}
+	}
+	auto order_of = [&names](std::vector<double>& values) {
+		std::vector<size_t> order(names.size());
+		std::iota(order.begin(), order.end(), 0);
+		std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+			return values[a] != values[b] ? values[a] > values[b] : names[a] < names[b];
+		});
+		return order;
+	};
+	std::vector<size_t> order = order_of(estimates);
+	number = std::min(number, (int)order.size());
+	std::vector<int> kept(number, 0);
+	for (auto& replicate : replicates) {
+		std::vector<size_t> replicate_order = order_of(replicate);
+		for (int rank = 0; rank < number; ++rank) {
+			if (replicate_order[rank] == order[rank]) {
+				kept[rank]++;
+			}
+		}
+	}
+	for (int rank = number - 1; rank >= 0; --rank) {
+		size_t i = order[rank];
+		std::vector<double> values;
+		for (auto& replicate : replicates) {
+			values.push_back(replicate[i]);
+		}
+		std::sort(values.begin(), values.end());
+		double low = values[(size_t)std::floor(0.025 * (values.size() - 1))];
+		double high = values[(size_t)std::ceil(0.975 * (values.size() - 1))];
+		std::cout << names[i] << ": " << estimates[i] << " (95% CI: " << low << " - " << high << ", keeps rank: " << 100 * kept[rank] / (int)replicates.size() << "%)" << std::endl;
+	}
+}
+
+/*
+ * The number of distinct words (exercise 1) or authors (exercise 2) can't simply be
+ * scaled up from the sample, as most of the values in the sample appear in the rest
+ * of the file as well. We use Chao's estimator of the number of distinct values for
+ * samples without replacement instead: seen + f1^2 / (2 * f2 + q / (1 - q) * f1), where
+ * f1 and f2 are the number of values seen in exactly one and two lines of the sample,
+ * and q is the sampled fraction. The values seen only once are the sign of the values
+ * never seen. It's still only a rough estimate for small samples, the confidence
+ * intervals only show the error coming from the randomness of the sample.
+ */
+inline double estimate_distinct(double seen, double once, double twice, double q) {
+	// if the whole file was read, we have seen everything.
+	if (q >= 1) {
+		return seen;
+	}
+	double denominator = 2 * twice + q / (1 - q) * once;
+	return denominator > 0 ? seen + once * once / denominator : seen;
+}
@@ -3,19 +3,52 @@
 
 #include "stdafx.h"
 #include "json.hpp"
-#include <unordered_map>
-#include <unordered_set>
+#include "flat_hash.h"
+#include "binary_io.h"
+#include "input_reader.h"
+#include "sampling.h"
+#include "frozen_dictionary.h"
+#include "ranking_snapshots.h"
 #include <fstream>
 #include <iostream>
 #include <string>
 #include <regex>
 #include <mutex>
 #include <thread>
+#include <map>
+#include <ctime>
+#include <chrono>
+#include <algorithm>
+#include <cstdio>
+#include <deque>
+#include <queue>
+#include <memory>
+#include <random>
+#include <numeric>
+#include <cmath>
+#include <atomic>
+#include <climits>
+#include <functional>
 
 
 using namespace std;
 using json = nlohmann::json;
 
+/*
+ * The memory used by the containers, for the memory report of the query server.
+ * memory_of returns the bytes a container (or string) allocates, not counting the
+ * object itself, which is either on the stack or already counted as part of the
+ * slots of the table holding it. Strings only allocate when they don't fit in the
+ * small string buffer.
+ */
+size_t memory_of(const string& s) {
+	return s.capacity() > 15 ? s.capacity() + 1 : 0;
+}
+
+size_t memory_of(const FlatHashSet<long>& set) {
+	return set.memory_usage();
+}
+
 /* 
  * Vocabularity is a container class to hold the result of each subreddit
  * It stores a string which is the name of the subreddit, and the number of
@@ -46,6 +79,112 @@ public:
 	}
 };
 
+/* 
+ * this function prints the most lexically diverse subreddits of a list of
+ * Vocabularities.
+ */
+void print_most_diverse(vector<Vocabularity>& vocabularities, int number) {
+	Vocabularity* top = new Vocabularity[number];
+	for (auto& current : vocabularities) {
+		for (int i = 0; i < number; ++i) {
+			if (current.getVoc() > top[i].getVoc()) {
+				if (i == 0) {
+					top[0] = current;
+				}
+				else {
+					Vocabularity tmp = top[i];
+					top[i] = top[i - 1];
+					top[i - 1] = tmp;
+				}
+			}
+		}
+	}
+	for (int i = 0; i < number; ++i) {
+		cout << top[i].getName() << ": " << top[i].getVoc() << endl;
+	}
+	delete[] top;
+}
+
+/*
+ * Progressive mode (--progress <seconds>): the current top list is printed at every
+ * interval while the file is still being read, so a long run can be stopped once the
+ * ranking settles. The vocabularies only grow, so a subreddit can only get on the list
+ * by growing past the smallest one on it, which is checked every time a word is added
+ * to it. So the list is always the exact top list of the words read so far. It gets
+ * to the printer through the double buffer of RankingSnapshots.
+ */
+class ProgressiveTopList {
+	int size;
+	vector<Vocabularity> ranking;
+	long smallest;
+	size_t smallest_index;
+	RankingSnapshots<Vocabularity> snapshots;
+public:
+	ProgressiveTopList(int s) {
+		size = s;
+		smallest = 0;
+		smallest_index = 0;
+	}
+
+	// not thread-safe, called by Subreddits under it's lock.
+	void update(const string& subreddit, long vocabularity) {
+		if ((int)ranking.size() < size || vocabularity > smallest) {
+			size_t i = 0;
+			while (i < ranking.size() && ranking[i].getName() != subreddit) {
+				i++;
+			}
+			if (i == ranking.size() && (int)ranking.size() < size) {
+				ranking.push_back(Vocabularity());
+			}
+			else if (i == ranking.size()) {
+				i = smallest_index;
+			}
+			ranking[i] = Vocabularity(subreddit, vocabularity);
+			if ((int)ranking.size() == size) {
+				smallest_index = 0;
+				for (size_t j = 1; j < ranking.size(); ++j) {
+					if (ranking[j].getVoc() < ranking[smallest_index].getVoc()) {
+						smallest_index = j;
+					}
+				}
+				smallest = ranking[smallest_index].getVoc();
+			}
+		}
+		if (snapshots.is_requested()) {
+			snapshots.publish(ranking);
+		}
+	}
+
+	// called after the workers are joined, the printer prints the final list last.
+	void finish() {
+		snapshots.finish(ranking);
+	}
+
+	RankingSnapshots<Vocabularity>* get_snapshots() {
+		return &snapshots;
+	}
+};
+
+// the printer thread of the progressive mode, until the snapshots are finished.
+void do_progress_work(ProgressiveTopList& progress, int interval, int number) {
+	auto start = chrono::steady_clock::now();
+	auto print_snapshot = [&](const vector<Vocabularity>* snapshot, const string& note) {
+		vector<Vocabularity> vocabularities = *snapshot;
+		cout << "--- after " << chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start).count() / 1000.0 << " s" << note << " ---" << endl;
+		print_most_diverse(vocabularities, number);
+	};
+	while (progress.get_snapshots()->wait(chrono::seconds(interval))) {
+		const vector<Vocabularity>* snapshot = progress.get_snapshots()->take(chrono::seconds(interval));
+		if (snapshot != nullptr) {
+			print_snapshot(snapshot, "");
+		}
+	}
+	const vector<Vocabularity>* snapshot = progress.get_snapshots()->get_final();
+	if (snapshot != nullptr) {
+		print_snapshot(snapshot, " (final)");
+	}
+}
+
 /*
  * WordsMap is a class to ensure multi-thread safe mapping of words into a hashed map.
  * We map each distinct word to a long number. We do this in order to save memory. Now
@@ -55,20 +194,46 @@ public:
 class WordsMap {
 	long counter;
 	mutex mu_write;
-	// unordered map, so lookup is constant, and fast.
-	unordered_map<string, long> map;
+	// hash map, so lookup is constant, and fast.
+	FlatHashMap<string, long> map;
+	// the words of an earlier run (see load_frozen), they are mapped to 1..n.
+	FrozenDictionary frozen;
 public:
 	// we map the first word to 1.
 	WordsMap() {
 		counter = 1;
 	}
 
+	/*
+	 * Loads the dictionary frozen by an earlier run on the same data (--dictionary). It's
+	 * words are looked up without the lock, and only the new words go into the map, with
+	 * the numbers after the frozen ones. Has to be called before the first insert.
+	 */
+	bool load_frozen(string path) {
+		if (!frozen.load(path)) {
+			return false;
+		}
+		counter = frozen.size() + 1;
+		return true;
+	}
+
+	// writes every word (the frozen ones too) as a frozen dictionary for the next runs.
+	bool freeze(string path) {
+		vector<string> words = get_words_by_number();
+		words.erase(words.begin());
+		return FrozenDictionary::write(path, words);
+	}
+
 	/*
 	 * Here is where the magic happens. This function can be executed only by one 
 	 * thread at a time. If it gets a word that is not in the map yet, it adds it.
 	 * Either way in the end it returns the number for which the word has been mapped.
 	 */
 	long shared_insert(string key) {
+		long long frozen_number = frozen.find(key);
+		if (frozen_number >= 0) {
+			return frozen_number + 1;
+		}
 		lock_guard<mutex> locker(mu_write);
 		long value = map[key];
 		if (value == 0) {
@@ -80,93 +245,470 @@ public:
 	}
 
 	long getNumberOfElements() {
-		return map.size();
+		return frozen.size() + map.size();
+	}
+
+	/*
+	 * returns the words of the numbers marked in used (used[number] is true), in the order
+	 * of their numbers. With a frozen dictionary most of it's words are usually not used
+	 * by a part of the input, so they are not copied.
+	 */
+	vector<string> get_used_words(const vector<bool>& used) {
+		vector<string> words;
+		for (size_t i = 0; i < frozen.size(); ++i) {
+			if (used[i + 1]) {
+				words.push_back(frozen.key(i));
+			}
+		}
+		vector<pair<long, string>> others;
+		for (auto element = map.begin(); element != map.end(); ++element) {
+			if (used[element->second]) {
+				others.push_back(make_pair(element->second, element->first));
+			}
+		}
+		sort(others.begin(), others.end());
+		for (const auto& other : others) {
+			words.push_back(other.second);
+		}
+		return words;
+	}
+
+	// returns every word at the index of it's mapped number (index 0 is unused).
+	vector<string> get_words_by_number() {
+		vector<string> words(counter);
+		for (size_t i = 0; i < frozen.size(); ++i) {
+			words[i + 1] = frozen.key(i);
+		}
+		for (auto element = map.begin(); element != map.end(); ++element) {
+			words[element->second] = element->first;
+		}
+		return words;
+	}
+
+	// number of bytes used by the map (see memory_of), and the frozen dictionary.
+	size_t memory_usage() {
+		size_t bytes = sizeof(map) + map.memory_usage() + frozen.memory_usage();
+		for (auto element = map.begin(); element != map.end(); ++element) {
+			bytes += memory_of(element->first);
+		}
+		return bytes;
 	}
 };
 
+/*
+ * Memory limit (--memory-limit): the subreddits are divided into SPILL_PARTITIONS
+ * partitions by the hash of their name. When the vocabularies would use more memory
+ * than the limit, the largest partitions are written to the spill directory and removed
+ * from the memory. In the end the spilled partitions are read back one at a time, so
+ * only one partition has to fit into the memory, and the result is the same as without
+ * the limit. The words map is not counted, it has to fit into the memory anyway.
+ */
+const int SPILL_PARTITIONS = 64;
+
+int partition_of(const string& subreddit) {
+	return flat_hash_bytes(subreddit.data(), subreddit.size()) % SPILL_PARTITIONS;
+}
+
 /*
  * Kind of same purpuse as the WordsMap except here we store each subreddit's
  * vocabulary in a map. The key is the name of the subreddit, and the value is
- * an unordered set of words. We use this data structure, because it let's us
+ * a hash set of words. We use this data structure, because it let's us
  * only store one value for every word. Therefore only distinct words will be
  * stored. And we only need the size of this later, which can be queried in a
  * really fast manner as well...
  */
 class Subreddits {
 	mutex mu_write;
-	unordered_map<string, unordered_set<long>> map;
+	FlatHashMap<string, FlatHashSet<long>> map;
+	// the memory limit in bytes (0 if there is none), and the bytes used by the
+	// vocabularies of every partition which are still in memory (see spill_partition).
+	size_t memory_limit;
+	size_t used;
+	vector<size_t> partition_bytes;
+	vector<bool> spilled;
+	string spill_directory;
+	bool spill_failed;
+	// the running top list of the progressive mode, null if it's off.
+	ProgressiveTopList* progress;
+
+	// the bytes of one subreddit: it's slot in the map, it's name and it's vocabulary.
+	size_t entry_bytes(const string& subreddit, const FlatHashSet<long>& words) {
+		return sizeof(string) + sizeof(FlatHashSet<long>) + memory_of(subreddit) + memory_of(words);
+	}
+
+	string spill_path(int partition) {
+		return spill_file_path(spill_directory, "task1", "partition-" + to_string(partition) + ".spill");
+	}
+
+	/*
+	 * Adds the growth of a subreddit's vocabulary to it's partition. If the vocabularies
+	 * use more than the limit now, the largest partitions are spilled until they use
+	 * less than 3/4 of it, so we don't spill again right after the next few words.
+	 */
+	void account(const string& subreddit, size_t before, size_t after) {
+		if (memory_limit == 0) {
+			return;
+		}
+		partition_bytes[partition_of(subreddit)] += after - before;
+		used += after - before;
+		if (used <= memory_limit) {
+			return;
+		}
+		while (used > memory_limit / 4 * 3) {
+			int largest = max_element(partition_bytes.begin(), partition_bytes.end()) - partition_bytes.begin();
+			if (partition_bytes[largest] == 0) {
+				break;
+			}
+			spill_partition(largest);
+		}
+	}
+
+	/*
+	 * Appends every vocabulary of the partition to it's spill file (a run: the number
+	 * of subreddits, then the subreddits sorted by name, each with it's sorted words),
+	 * and removes them from the memory. The subreddits of a spilled partition can come
+	 * again later, they are collected in memory again, and they may be spilled again
+	 * as an other run of the same file.
+	 */
+	void spill_partition(int partition) {
+		vector<string> names;
+		for (auto element = map.begin(); element != map.end(); ++element) {
+			if (partition_of(element->first) == partition) {
+				names.push_back(element->first);
+			}
+		}
+		sort(names.begin(), names.end());
+		ofstream out(spill_path(partition), ios::binary | (!spilled[partition] ? ios::trunc : ios::app));
+		write_varint(out, names.size());
+		for (const auto& name : names) {
+			FlatHashSet<long>& words = map[name];
+			write_string(out, name);
+			write_numbers(out, vector<long>(words.begin(), words.end()));
+			map.erase(name);
+		}
+		spill_failed = spill_failed || !out.good();
+		cout << "spilled partition " << partition << ": " << names.size() << " subreddits, " << partition_bytes[partition] / (1 << 20) << " Mb" << endl;
+		used -= partition_bytes[partition];
+		partition_bytes[partition] = 0;
+		spilled[partition] = true;
+	}
+
+	/*
+	 * Reads back every run of a spilled partition, and merges them with the part of
+	 * the partition which is still in memory, into the vocabularities. The spill file
+	 * is removed after this.
+	 */
+	bool count_spilled(int partition, vector<Vocabularity>& vocabularities) {
+		FlatHashMap<string, FlatHashSet<long>> merged;
+		ifstream in(spill_path(partition), ios::binary);
+		while (in.good() && in.peek() != EOF) {
+			unsigned long long number_of_subreddits = read_length(in);
+			for (unsigned long long i = 0; i < number_of_subreddits && in.good(); ++i) {
+				string subreddit = read_string(in);
+				vector<long> numbers = read_numbers(in);
+				merged[subreddit].insert(numbers.begin(), numbers.end());
+			}
+		}
+		bool ok = !in.fail();
+		in.close();
+		remove(spill_path(partition).c_str());
+		for (auto element = map.begin(); element != map.end(); ++element) {
+			if (partition_of(element->first) == partition) {
+				merged[element->first].insert(element->second.begin(), element->second.end());
+			}
+		}
+		for (auto element = merged.begin(); element != merged.end(); ++element) {
+			vocabularities.push_back(Vocabularity(element->first, element->second.size()));
+		}
+		return ok;
+	}
 public:
+	Subreddits() {
+		memory_limit = 0;
+		used = 0;
+		spill_failed = false;
+		progress = nullptr;
+	}
+
+	// turns on the progressive mode, has to be called before the first insert.
+	void set_progress(ProgressiveTopList* progress_in) {
+		progress = progress_in;
+	}
+
+	/*
+	 * Limits the memory used by the vocabularies (--memory-limit). Over the limit the
+	 * largest partitions are written to the directory, and getMostDiverse reads them
+	 * back one by one. Has to be called before the first insert.
+	 */
+	void set_memory_limit(size_t limit, string directory) {
+		memory_limit = limit;
+		spill_directory = directory;
+		partition_bytes.assign(SPILL_PARTITIONS, 0);
+		spilled.assign(SPILL_PARTITIONS, false);
+	}
+
+	// false if a spill file could not be written.
+	bool spill_ok() {
+		return !spill_failed;
+	}
+
 	/*
 	 * This function can be only executed by one thread at a time. It adds a word's
 	 * mapped number to the set of words. If the reddit is new it creates it. 
 	 */
 	void shared_insert(string subreddit, long word_number) {
 		lock_guard<mutex> locker(mu_write);
+		size_t before = 0;
 		if (map.count(subreddit) == 0) {
-			unordered_set<long> tmp;
+			FlatHashSet<long> tmp;
 			map[subreddit] = tmp;
 		}
-		map[subreddit].insert(word_number);
+		else {
+			before = entry_bytes(subreddit, map[subreddit]);
+		}
+		FlatHashSet<long>& words = map[subreddit];
+		if (words.insert(word_number).second && progress != nullptr) {
+			progress->update(subreddit, words.size());
+		}
+		account(subreddit, before, entry_bytes(subreddit, words));
 	}
 
 	long getNumberOfWordsInSubreddit(string subreddit) {
 		return map[subreddit].size();
 	}
 
+	// same as shared_insert, but for many words at once, so we only lock once.
+	void shared_insert_all(string subreddit, const vector<long>& word_numbers) {
+		lock_guard<mutex> locker(mu_write);
+		size_t before = map.count(subreddit) == 0 ? 0 : entry_bytes(subreddit, map[subreddit]);
+		FlatHashSet<long>& words = map[subreddit];
+		words.insert(word_numbers.begin(), word_numbers.end());
+		if (progress != nullptr) {
+			progress->update(subreddit, words.size());
+		}
+		account(subreddit, before, entry_bytes(subreddit, words));
+	}
+
+	FlatHashMap<string, FlatHashSet<long>>* getMap() {
+		return &map;
+	}
+
+	bool contains(string subreddit) {
+		return map.count(subreddit) != 0;
+	}
+
+	long getNumberOfSubreddits() {
+		return map.size();
+	}
+
+	// number of bytes used by all the vocabularies (see memory_of).
+	size_t memory_usage() {
+		size_t bytes = sizeof(map) + map.memory_usage();
+		for (auto element = map.begin(); element != map.end(); ++element) {
+			bytes += memory_of(element->first) + memory_of(element->second);
+		}
+		return bytes;
+	}
+
+	/*
+	 * Adds every word of an other Subreddits object to this one. Since the words are
+	 * mapped with the same WordsMap everywhere, the union of the two sets is exactly
+	 * the vocabulary of the merged time window. Not thread-safe, only used after the
+	 * data gathering finished.
+	 */
+	void merge(Subreddits& other) {
+		for (auto element = other.map.begin(); element != other.map.end(); ++element) {
+			map[element->first].insert(element->second.begin(), element->second.end());
+		}
+	}
+
 	/* 
 	 * this function prints a list of Vocabularities with the most lexically 
 	 * diverse subreddits.
 	 */
-	void getMostDiverse(int number) {
-		Vocabularity* top = new Vocabularity[number];
+	// With a memory limit the spilled partitions are merged back one by one here, false
+	// if one of them could not be read.
+	bool getMostDiverse(int number) {
+		vector<Vocabularity> vocabularities;
+		bool ok = true;
 		for (auto element = map.begin(); element != map.end(); ++element) {
-			Vocabularity current(element->first, element->second.size());
-			for (int i = 0; i < number; ++i) {
-				if (current.getVoc() > top[i].getVoc()) {
-					if (i == 0) {
-						top[0] = current;
-					}
-					else {
-						Vocabularity tmp = top[i];
-						top[i] = top[i - 1];
-						top[i - 1] = tmp;
-					}
-				}
+			if (memory_limit == 0 || !spilled[partition_of(element->first)]) {
+				vocabularities.push_back(Vocabularity(element->first, element->second.size()));
 			}
 		}
-		for (int i = 0; i < number; ++i) {
-			cout << top[i].getName() << ": " << top[i].getVoc() << endl;
+		for (int partition = 0; partition < SPILL_PARTITIONS && memory_limit != 0; ++partition) {
+			if (spilled[partition]) {
+				ok = count_spilled(partition, vocabularities) && ok;
+			}
 		}
+		if (ok) {
+			print_most_diverse(vocabularities, number);
+		}
+		return ok;
 	}
 };
 
 
 /*
- * SharedFileReader is a class responsible of reading in a thread-safe manner from the
- * same file without leaving out lines, or reading the same twice.
+ * Helpers for the time-bucketed mode. A bucket is just the number of days (or weeks)
+ * elapsed since 1970-01-01, computed from the created_utc field of the comment. Weeks
+ * start on monday (1970-01-01 was a thursday, hence the +3).
  */
-class SharedFileReader {
-	mutex mu_read, mu_write;
-	ifstream input;
+long get_created_utc(json& json_line) {
+	// older dumps store the timestamp as a string, newer ones as a number...
+	if (json_line["created_utc"].is_string()) {
+		return stol(json_line["created_utc"].get<string>());
+	}
+	return json_line["created_utc"].get<long>();
+}
+
+long day_of(long created_utc) {
+	return created_utc / 86400;
+}
+
+long week_of_day(long day) {
+	return (day + 3) / 7;
+}
+
+// prints a day bucket as YYYY-MM-DD, so the output is readable.
+string day_label(long day) {
+	time_t t = day * 86400;
+	char buffer[16];
+	strftime(buffer, sizeof(buffer), "%Y-%m-%d", gmtime(&t));
+	return string(buffer);
+}
+
+/*
+ * BucketedSubreddits stores a separate Subreddits object for every day. The word
+ * numbers come from the same WordsMap for every day, so the dictionary is only
+ * stored once no matter how many buckets there are. Days can be merged together
+ * into weeks (or the whole file) without reading the file again, because the
+ * vocabulary of a longer window is the union of the daily vocabularies.
+ */
+class BucketedSubreddits {
+	mutex mu_write;
+	// std::map so the buckets are printed in chronological order.
+	map<long, Subreddits> days;
 public:
-	SharedFileReader() {
-		input = ifstream("C:\\reddit\\reddit");
+	// thread-safe, creates the day if it did not exist yet.
+	void shared_insert(long day, string subreddit, long word_number) {
+		Subreddits* bucket;
+		{
+			lock_guard<mutex> locker(mu_write);
+			bucket = &days[day];
+		}
+		// Subreddits::shared_insert has it's own lock, and map nodes never move.
+		bucket->shared_insert(subreddit, word_number);
 	}
 
-	// this can only be executed by one thread at a time, and it returns a new line.
-	basic_istream<char>& shared_read(string& line) {
-		lock_guard<mutex> locker(mu_read);
-		return getline(input, line);
+	/*
+	 * Builds the weeks one at a time, gives every week to print_week, and merges the days
+	 * into total (the whole file) on the way. A day is removed as soon as it's in it's
+	 * week and in the total, so only one week is in memory besides the days, and the
+	 * days shrink while the total grows. The days are gone after this.
+	 */
+	void merge_weeks(Subreddits& total, function<void(long, Subreddits&)> print_week) {
+		auto day = days.begin();
+		while (day != days.end()) {
+			long week = week_of_day(day->first);
+			Subreddits week_subreddits;
+			for (; day != days.end() && week_of_day(day->first) == week; day = days.erase(day)) {
+				week_subreddits.merge(day->second);
+				total.merge(day->second);
+			}
+			print_week(week, week_subreddits);
+		}
 	}
 
-	// this is a thread-safe print, just for debugging purposes.
-	void shared_print(string line) {
-		lock_guard<mutex> locker2(mu_write);
-		cout << line << endl;
+	// prints the top list for every day and for every week, and merges the days into
+	// total (see merge_weeks).
+	void print(int number, Subreddits& total) {
+		for (auto day = days.begin(); day != days.end(); ++day) {
+			cout << "--- day " << day_label(day->first) << " ---" << endl;
+			day->second.getMostDiverse(number);
+		}
+		merge_weeks(total, [number](long week, Subreddits& subreddits) {
+			cout << "--- week starting " << day_label(week * 7 - 3) << " ---" << endl;
+			subreddits.getMostDiverse(number);
+		});
 	}
+};
 
 
-};
+const string PARTIAL_MAGIC = "bigdata-challenge-2 task1 partial v1";
+
+/*
+ * A partial result contains the words used by the process's subreddits (in the order
+ * of their numbers, they get the local numbers 1, 2, ...), and every subreddit's
+ * vocabulary with these local numbers. The other words are left out, so with
+ * --dictionary a partial does not contain the whole frozen dictionary.
+ */
+bool write_partial(string path, Subreddits& subreddits, WordsMap& words) {
+	ofstream out(path, ios::binary);
+	write_string(out, PARTIAL_MAGIC);
+	vector<bool> used(words.getNumberOfElements() + 1, false);
+	for (auto element = subreddits.getMap()->begin(); element != subreddits.getMap()->end(); ++element) {
+		for (const auto& number : element->second) {
+			used[number] = true;
+		}
+	}
+	vector<long> local(used.size(), 0);
+	long next = 1;
+	for (size_t number = 1; number < used.size(); ++number) {
+		if (used[number]) {
+			local[number] = next++;
+		}
+	}
+	vector<string> used_words = words.get_used_words(used);
+	write_varint(out, used_words.size() + 1);
+	for (const auto& word : used_words) {
+		write_string(out, word);
+	}
+	write_varint(out, subreddits.getMap()->size());
+	for (auto element = subreddits.getMap()->begin(); element != subreddits.getMap()->end(); ++element) {
+		write_string(out, element->first);
+		vector<long> numbers;
+		for (const auto& number : element->second) {
+			numbers.push_back(local[number]);
+		}
+		write_numbers(out, numbers);
+	}
+	return out.good();
+}
+
+/*
+ * Reads a partial result and merges it into the subreddits. The local word numbers of
+ * the partial are remapped to our own numbers through the (shared) words map first.
+ * Thread-safe, so several partials can be read at the same time.
+ */
+bool read_partial(string path, Subreddits& subreddits, WordsMap& words) {
+	ifstream in(path, ios::binary);
+	if (read_string(in) != PARTIAL_MAGIC) {
+		return false;
+	}
+	vector<long> remap(read_length(in));
+	for (size_t i = 1; i < remap.size() && in.good(); ++i) {
+		remap[i] = words.shared_insert(read_string(in));
+	}
+	unsigned long long number_of_subreddits = read_length(in);
+	for (unsigned long long i = 0; i < number_of_subreddits && in.good(); ++i) {
+		string subreddit = read_string(in);
+		vector<long> numbers = read_numbers(in);
+		for (auto& number : numbers) {
+			if (number < 0 || number >= (long)remap.size()) {
+				return false;
+			}
+			number = remap[number];
+		}
+		subreddits.shared_insert_all(subreddit, numbers);
+	}
+	return in.good();
+}
+
+// the thread function of the reducer, reads one partial result.
+void do_reduce_work(string path, Subreddits& subreddits, WordsMap& words, bool& ok) {
+	ok = read_partial(path, subreddits, words);
+}
 
 // cleaning the comments from special chars and converting everything to lowercase.
 string clear_lines(string line) {
@@ -197,41 +739,413 @@ vector<string> get_words(string line) {
  *   4. map every word to a number
  *   5. add each mapped value to the actual subreddit's vocabulary
  *        - note: no word can be stored twice. This is achieved with the data structure
- *                used to store the numbers (unordered_set)
+ *                used to store the numbers (FlatHashSet)
  */
-void do_work(SharedFileReader& reader, Subreddits& subreddits, WordsMap& words) {
+// If buckets is not null, the words go into the day of the comment instead of the
+// global subreddits (which will be built from the days in the end).
+void do_work(SharedFileReader& reader, Subreddits& subreddits, WordsMap& words, BucketedSubreddits* buckets) {
 	for (string line; reader.shared_read(line); ) {
 		auto json_line = json::parse(line.c_str());
 		string subreddit = json_line["subreddit"];
+		long day = buckets != nullptr ? day_of(get_created_utc(json_line)) : 0;
 		for (auto& word : get_words(clear_lines(json_line["body"]))) {
 			long word_index = words.shared_insert(word);
-			subreddits.shared_insert(subreddit, word_index);
+			if (buckets != nullptr) {
+				buckets->shared_insert(day, subreddit, word_index);
+			}
+			else {
+				subreddits.shared_insert(subreddit, word_index);
+			}
 		}
 		
 	}
 	
 }
 
-int main()
-{
-	// create shared file reader, we will pass it to each thread. 
-	SharedFileReader file_reader;
-	// create words map, to map each word to number. We will pass it to each thread.
-	WordsMap words;
-	// create subreddits to store each subreddit's vocabulary with mapped words.
-	Subreddits subreddits;
+/*
+ * Query server mode. After the data gathering, instead of printing the toplist and
+ * exiting, we keep everything in memory and answer queries read from the standard
+ * input, one per line, so the file does not have to be processed again for every
+ * variation of the question:
+ *   top <k>           the k subreddits with the largest vocabulary
+ *   vocab <subreddit> the size of the vocabulary of one subreddit
+ *   memory            the estimated memory used by each index
+ *   quit
+ * Every answer is closed by an "ok" line (or starts with "error"), followed by the
+ * time it took to answer.
+ */
+void serve(Subreddits& subreddits, WordsMap& words) {
+	cout << "ready" << endl;
+	for (string line; getline(cin, line); ) {
+		istringstream iss(line);
+		string command;
+		iss >> command;
+		if (command.empty()) {
+			continue;
+		}
+		if (command == "quit") {
+			break;
+		}
+		auto start = chrono::steady_clock::now();
+		if (command == "top") {
+			int number = 10;
+			iss >> number;
+			if (number <= 0) {
+				cout << "error: k must be positive" << endl;
+				continue;
+			}
+			// there are no more subreddits to list than we have.
+			number = (int)min((long)number, subreddits.getNumberOfSubreddits());
+			subreddits.getMostDiverse(number);
+		}
+		else if (command == "vocab") {
+			string subreddit;
+			iss >> subreddit;
+			if (!subreddits.contains(subreddit)) {
+				cout << "error: unknown subreddit " << subreddit << endl;
+				continue;
+			}
+			cout << subreddit << ": " << subreddits.getNumberOfWordsInSubreddit(subreddit) << endl;
+		}
+		else if (command == "memory") {
+			cout << "words: " << words.getNumberOfElements() << " words, " << words.memory_usage() << " bytes" << endl;
+			cout << "subreddits: " << subreddits.getNumberOfSubreddits() << " subreddits, " << subreddits.memory_usage() << " bytes" << endl;
+		}
+		else {
+			cout << "error: unknown command " << command << endl;
+			continue;
+		}
+		auto elapsed = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start);
+		cout << "ok " << elapsed.count() / 1000.0 << " ms" << endl;
+	}
+}
 
-	// create four threads. Because this is how much my computer can handle...
-	// pass the shared assets to each of them and the function to execute.
-	thread t1(do_work, ref(file_reader), ref(subreddits), ref(words));
-	thread t2(do_work, ref(file_reader), ref(subreddits), ref(words));
-	thread t3(do_work, ref(file_reader), ref(subreddits), ref(words));
-	thread t4(do_work, ref(file_reader), ref(subreddits), ref(words));
-	thread t5(do_work, ref(file_reader), ref(subreddits), ref(words));
-	thread t6(do_work, ref(file_reader), ref(subreddits), ref(words));
-	thread t7(do_work, ref(file_reader), ref(subreddits), ref(words));
-	thread t8(do_work, ref(file_reader), ref(subreddits), ref(words));
-	// here we wait for each thread to finish work
+/*
+ * Sort-based counting (--sort-based), an alternative to the sets in Subreddits. Every
+ * thread packs the (subreddit number, word number) pairs into 64 bit keys (subreddit
+ * in the upper 32 bits, word in the lower 32 bits) and collects them in it's own
+ * buffer. The full buffers go into a shared batch, and a full batch is radix sorted by
+ * all the threads together, and the duplicates are removed. The resulting sorted run is
+ * handed to SortedRuns. In the end the runs are merged, and the number of distinct
+ * keys for each subreddit is it's vocabulary. Everything is read and written
+ * sequentially, and the memory used is the buffers, the batch and the runs, which stay
+ * under SORT_RUNS_BUDGET (see SortedRuns).
+ */
+typedef unsigned long long Key;
+
+// number of keys in the buffer of each thread (8 Mb), and in a batch (128 Mb). They
+// can be set when compiling, the checks of tools/ use small batches to make more runs.
+#ifndef SORT_BUFFER_KEYS
+#define SORT_BUFFER_KEYS (1 << 20)
+#endif
+#ifndef SORT_BATCH_KEYS
+#define SORT_BATCH_KEYS (1 << 24)
+#endif
+// the bytes of the sorted runs kept in memory (512 Mb).
+#ifndef SORT_RUNS_BUDGET
+#define SORT_RUNS_BUDGET (512 << 20)
+#endif
+const int SORT_THREADS = 8;
+
+// runs work(0), ..., work(SORT_THREADS - 1) on their own threads, and waits for all of them.
+void run_sort_threads(function<void(int)> work) {
+	vector<thread> threads;
+	for (int i = 0; i < SORT_THREADS; ++i) {
+		threads.push_back(thread(work, i));
+	}
+	for (auto& t : threads) {
+		t.join();
+	}
+}
+
+/*
+ * Parallel LSD radix sort with 8 bits per pass. The keys are cut into SORT_THREADS
+ * slices. In every pass each thread counts the bytes of it's own slice, then the
+ * offset of every (byte, slice) is computed: the keys with a smaller byte, and the keys
+ * with the same byte in the earlier slices. Each thread moves it's slice to these
+ * offsets, so the sort stays stable, and no two threads write the same place. The
+ * histograms of all the 8 bytes are built in the first pass, and the passes where
+ * every key has the same byte are skipped (e.g. the upper bytes of the subreddit
+ * numbers are mostly 0).
+ */
+void radix_sort(vector<Key>& keys) {
+	size_t size = keys.size();
+	vector<Key> buffer(size);
+	// counts[slice][b * 256 + byte] in the first pass, then only the byte of the pass.
+	vector<vector<size_t>> counts(SORT_THREADS, vector<size_t>(8 * 256, 0));
+	run_sort_threads([&](int slice) {
+		for (size_t i = size * slice / SORT_THREADS; i < size * (slice + 1) / SORT_THREADS; ++i) {
+			for (int b = 0; b < 8; ++b) {
+				counts[slice][b * 256 + ((keys[i] >> (8 * b)) & 0xff)]++;
+			}
+		}
+	});
+	bool sorted_once = false;
+	for (int b = 0; b < 8 && size > 0; ++b) {
+		size_t same = 0;
+		for (int slice = 0; slice < SORT_THREADS; ++slice) {
+			same += counts[slice][b * 256 + ((keys[0] >> (8 * b)) & 0xff)];
+		}
+		if (same == size) {
+			continue;
+		}
+		// after the first moved pass the slices have other keys, so they are counted again.
+		if (sorted_once) {
+			run_sort_threads([&](int slice) {
+				size_t* count = &counts[slice][b * 256];
+				fill(count, count + 256, 0);
+				for (size_t i = size * slice / SORT_THREADS; i < size * (slice + 1) / SORT_THREADS; ++i) {
+					count[(keys[i] >> (8 * b)) & 0xff]++;
+				}
+			});
+		}
+		size_t offset = 0;
+		for (int byte = 0; byte < 256; ++byte) {
+			for (int slice = 0; slice < SORT_THREADS; ++slice) {
+				size_t tmp = counts[slice][b * 256 + byte];
+				counts[slice][b * 256 + byte] = offset;
+				offset += tmp;
+			}
+		}
+		run_sort_threads([&](int slice) {
+			size_t* position = &counts[slice][b * 256];
+			for (size_t i = size * slice / SORT_THREADS; i < size * (slice + 1) / SORT_THREADS; ++i) {
+				buffer[position[(keys[i] >> (8 * b)) & 0xff]++] = keys[i];
+			}
+		});
+		keys.swap(buffer);
+		sorted_once = true;
+	}
+}
+
+void sort_and_deduplicate(vector<Key>& keys) {
+	radix_sort(keys);
+	keys.erase(unique(keys.begin(), keys.end()), keys.end());
+}
+
+/*
+ * RunReader reads the keys of a sorted run one by one, either from the memory or
+ * from a spill file (in that case in blocks, so the file is read sequentially).
+ */
+class RunReader {
+	vector<Key> keys;
+	size_t position;
+	ifstream input;
+	bool from_file;
+public:
+	RunReader(vector<Key>& run) {
+		keys.swap(run);
+		position = 0;
+		from_file = false;
+	}
+
+	RunReader(string path) {
+		input = ifstream(path, ios::binary);
+		position = 0;
+		from_file = true;
+	}
+
+	bool next(Key& key) {
+		if (position == keys.size()) {
+			if (!from_file) {
+				return false;
+			}
+			keys.resize(1 << 16);
+			input.read((char*)keys.data(), keys.size() * sizeof(Key));
+			keys.resize(input.gcount() / sizeof(Key));
+			position = 0;
+			if (keys.empty()) {
+				return false;
+			}
+		}
+		key = keys[position++];
+		return true;
+	}
+};
+
+// k-way merge of the runs with a heap, calls output with every distinct key in order
+// (the same key can be in more runs, but it's only given once).
+template <class Output>
+void merge_runs(vector<unique_ptr<RunReader>>& readers, Output output) {
+	priority_queue<pair<Key, size_t>, vector<pair<Key, size_t>>, greater<pair<Key, size_t>>> heap;
+	Key key;
+	for (size_t i = 0; i < readers.size(); ++i) {
+		if (readers[i]->next(key)) {
+			heap.push(make_pair(key, i));
+		}
+	}
+	bool first = true;
+	Key last = 0;
+	while (!heap.empty()) {
+		pair<Key, size_t> top = heap.top();
+		heap.pop();
+		if (first || top.first != last) {
+			output(top.first);
+			last = top.first;
+			first = false;
+		}
+		if (readers[top.second]->next(key)) {
+			heap.push(make_pair(key, top.second));
+		}
+	}
+}
+
+/*
+ * SortedRuns collects the full buffers of the threads into a batch, sorts the full
+ * batches, and keeps the sorted runs. When the runs in memory use more than
+ * SORT_RUNS_BUDGET bytes, they are merged into one run (the same pair is often in
+ * many runs), and if that is still more than half of the budget, it is written to the
+ * spill directory (. by default). The files are named after the process id, so several
+ * runs can use the same directory. In the end all the runs are merged to count the
+ * distinct keys.
+ */
+class SortedRuns {
+	mutex mu_write;
+	vector<Key> batch;
+	vector<vector<Key>> runs;
+	size_t run_bytes;
+	vector<string> run_files;
+	string spill_directory;
+	bool ok;
+
+	// merges the runs in memory into one, the caller holds the lock.
+	void merge_in_memory() {
+		vector<unique_ptr<RunReader>> readers;
+		size_t size = 0;
+		for (auto& run : runs) {
+			size += run.size();
+			readers.push_back(unique_ptr<RunReader>(new RunReader(run)));
+		}
+		runs.clear();
+		vector<Key> merged;
+		merged.reserve(size);
+		merge_runs(readers, [&merged](Key key) {
+			merged.push_back(key);
+		});
+		merged.shrink_to_fit();
+		run_bytes = merged.size() * sizeof(Key);
+		runs.push_back(vector<Key>());
+		runs.back().swap(merged);
+	}
+
+	// writes the (only) run in memory to a file, the caller holds the lock.
+	void spill() {
+		string path = spill_file_path(spill_directory, "task1", "run" + to_string(run_files.size()) + ".bin");
+		ofstream out(path, ios::binary);
+		out.write((const char*)runs.back().data(), runs.back().size() * sizeof(Key));
+		ok = out.good() && ok;
+		run_files.push_back(path);
+		cout << "spilled sorted run " << path << ": " << run_bytes / 1048576 << " Mb" << endl;
+		runs.clear();
+		run_bytes = 0;
+	}
+
+	// sorts a batch (outside the lock, with all the threads), and adds it's run.
+	void add_batch(vector<Key>& keys) {
+		sort_and_deduplicate(keys);
+		lock_guard<mutex> locker(mu_write);
+		run_bytes += keys.size() * sizeof(Key);
+		runs.push_back(vector<Key>());
+		runs.back().swap(keys);
+		if (run_bytes > SORT_RUNS_BUDGET) {
+			merge_in_memory();
+			if (run_bytes > SORT_RUNS_BUDGET / 2) {
+				spill();
+			}
+		}
+	}
+public:
+	SortedRuns(string spill_directory_in) {
+		spill_directory = spill_directory_in;
+		run_bytes = 0;
+		ok = true;
+	}
+
+	// thread-safe, takes the keys of a full buffer. The thread which fills the batch
+	// sorts it.
+	void shared_add(vector<Key>& keys) {
+		vector<Key> full;
+		{
+			lock_guard<mutex> locker(mu_write);
+			if (batch.empty()) {
+				batch.reserve(SORT_BATCH_KEYS);
+			}
+			batch.insert(batch.end(), keys.begin(), keys.end());
+			keys.clear();
+			if (batch.size() < SORT_BATCH_KEYS) {
+				return;
+			}
+			full.swap(batch);
+		}
+		add_batch(full);
+	}
+
+	// merges the runs (and the rest of the batch), and returns the number of distinct
+	// words for every subreddit number, or false if a run could not be written. The runs
+	// (and the spill files) are gone after this.
+	bool count_distinct(size_t number_of_subreddits, vector<long>& counts) {
+		if (!batch.empty()) {
+			vector<Key> rest;
+			rest.swap(batch);
+			add_batch(rest);
+		}
+		counts.assign(number_of_subreddits, 0);
+		vector<unique_ptr<RunReader>> readers;
+		for (auto& run : runs) {
+			readers.push_back(unique_ptr<RunReader>(new RunReader(run)));
+		}
+		for (const auto& path : run_files) {
+			readers.push_back(unique_ptr<RunReader>(new RunReader(path)));
+		}
+		runs.clear();
+		if (ok) {
+			merge_runs(readers, [&counts](Key key) {
+				counts[key >> 32]++;
+			});
+		}
+		readers.clear();
+		for (const auto& path : run_files) {
+			remove(path.c_str());
+		}
+		return ok;
+	}
+};
+
+/*
+ * The data-gathering function of the sort-based mode. Same as do_work, except the
+ * subreddits are mapped to numbers as well (with an other WordsMap), and the words go
+ * to the thread's buffer instead of the shared Subreddits, so there is no lock here
+ * apart from the maps (and the batch, once per buffer).
+ */
+void do_sort_work(SharedFileReader& reader, WordsMap& subreddit_numbers, WordsMap& words, SortedRuns& runs) {
+	vector<Key> keys;
+	keys.reserve(SORT_BUFFER_KEYS);
+	for (string line; reader.shared_read(line); ) {
+		auto json_line = json::parse(line.c_str());
+		Key subreddit_number = subreddit_numbers.shared_insert(json_line["subreddit"]);
+		for (auto& word : get_words(clear_lines(json_line["body"]))) {
+			keys.push_back((subreddit_number << 32) | (Key)words.shared_insert(word));
+			if (keys.size() == SORT_BUFFER_KEYS) {
+				runs.shared_add(keys);
+			}
+		}
+	}
+	runs.shared_add(keys);
+}
+
+// runs the whole sort-based mode and prints the most diverse subreddits.
+bool count_by_sorting(SharedFileReader& file_reader, WordsMap& words, string spill_directory, int number) {
+	WordsMap subreddit_numbers;
+	SortedRuns runs(spill_directory);
+
+	thread t1(do_sort_work, ref(file_reader), ref(subreddit_numbers), ref(words), ref(runs));
+	thread t2(do_sort_work, ref(file_reader), ref(subreddit_numbers), ref(words), ref(runs));
+	thread t3(do_sort_work, ref(file_reader), ref(subreddit_numbers), ref(words), ref(runs));
+	thread t4(do_sort_work, ref(file_reader), ref(subreddit_numbers), ref(words), ref(runs));
+	thread t5(do_sort_work, ref(file_reader), ref(subreddit_numbers), ref(words), ref(runs));
+	thread t6(do_sort_work, ref(file_reader), ref(subreddit_numbers), ref(words), ref(runs));
+	thread t7(do_sort_work, ref(file_reader), ref(subreddit_numbers), ref(words), ref(runs));
+	thread t8(do_sort_work, ref(file_reader), ref(subreddit_numbers), ref(words), ref(runs));
 	t1.join();
 	t2.join();
 	t3.join();
@@ -241,8 +1155,451 @@ int main()
 	t7.join();
 	t8.join();
 
+	vector<string> names = subreddit_numbers.get_words_by_number();
+	vector<long> counts;
+	if (!runs.count_distinct(names.size(), counts)) {
+		return false;
+	}
+	vector<Vocabularity> vocabularities;
+	for (size_t i = 1; i < names.size(); ++i) {
+		vocabularities.push_back(Vocabularity(names[i], counts[i]));
+	}
+	print_most_diverse(vocabularities, number);
+	return true;
+}
+
+// For the bootstrap we keep the sampled block (see sample_block) of every line a word
+// of a subreddit was in.
+class SampledSubreddits {
+	mutex mu_write;
+	FlatHashMap<string, FlatHashMap<long, vector<unsigned long long>>> map;
+public:
+	// thread-safe, adds the distinct words of one line.
+	void shared_insert_all(string subreddit, const vector<long>& word_numbers, unsigned long long block) {
+		lock_guard<mutex> locker(mu_write);
+		FlatHashMap<long, vector<unsigned long long>>& words = map[subreddit];
+		for (const auto& word_number : word_numbers) {
+			words[word_number].push_back(block);
+		}
+	}
+
+	/*
+	 * Computes the estimate of every subreddit, and the same with the weights of every
+	 * replicate (see print_sampled_toplist). The replicates are divided between 8 threads.
+	 * Not thread-safe, only used after the data gathering.
+	 */
+	void estimate(double sampled_fraction, vector<string>& names, vector<double>& estimates, vector<vector<double>>& replicates) {
+		vector<FlatHashMap<long, vector<unsigned long long>>*> vocabularies;
+		for (auto element = map.begin(); element != map.end(); ++element) {
+			long once = 0, twice = 0;
+			for (const auto& word : element->second) {
+				once += word.second.size() == 1;
+				twice += word.second.size() == 2;
+			}
+			names.push_back(element->first);
+			estimates.push_back(estimate_distinct(element->second.size(), once, twice, sampled_fraction));
+			vocabularies.push_back(&element->second);
+		}
+		replicates.assign(REPLICATES, vector<double>(names.size(), 0));
+		vector<thread> threads;
+		for (int part = 0; part < 8; ++part) {
+			threads.push_back(thread([&, part]() {
+				for (int replicate = part; replicate < REPLICATES; replicate += 8) {
+					for (size_t i = 0; i < vocabularies.size(); ++i) {
+						long seen = 0, once = 0, twice = 0;
+						for (const auto& word : *vocabularies[i]) {
+							long count = 0;
+							for (const auto& block : word.second) {
+								count += bootstrap_weight(block, replicate);
+							}
+							seen += count > 0;
+							once += count == 1;
+							twice += count == 2;
+						}
+						replicates[replicate][i] = estimate_distinct(seen, once, twice, sampled_fraction);
+					}
+				}
+			}));
+		}
+		for (auto& t : threads) {
+			t.join();
+		}
+	}
+};
+
+// the data gathering of the sampling mode, the same as do_work, but a word is only
+// stored once per line, with the block of the line.
+void do_sample_work(SharedFileReader& reader, SampledSubreddits& sampled, WordsMap& words) {
+	int file;
+	long long offset;
+	for (string line; reader.shared_read(line, file, offset); ) {
+		auto json_line = json::parse(line.c_str());
+		string subreddit = json_line["subreddit"];
+		vector<long> word_numbers;
+		for (auto& word : get_words(clear_lines(json_line["body"]))) {
+			word_numbers.push_back(words.shared_insert(word));
+		}
+		sort(word_numbers.begin(), word_numbers.end());
+		word_numbers.erase(unique(word_numbers.begin(), word_numbers.end()), word_numbers.end());
+		sampled.shared_insert_all(subreddit, word_numbers, sample_block(file, offset));
+	}
+}
+
+// reads the sample with 8 threads, and prints the number most diverse subreddits
+// estimated from it.
+void estimate_from_sample(vector<string>& files, LineFilter& filter, WordsMap& words, double fraction, unsigned long long seed, int number) {
+	double sampled_fraction;
+	SharedFileReader file_reader(files, get_sample_ranges(files, fraction, seed, sampled_fraction), filter);
+	SampledSubreddits sampled;
+
+	thread t1(do_sample_work, ref(file_reader), ref(sampled), ref(words));
+	thread t2(do_sample_work, ref(file_reader), ref(sampled), ref(words));
+	thread t3(do_sample_work, ref(file_reader), ref(sampled), ref(words));
+	thread t4(do_sample_work, ref(file_reader), ref(sampled), ref(words));
+	thread t5(do_sample_work, ref(file_reader), ref(sampled), ref(words));
+	thread t6(do_sample_work, ref(file_reader), ref(sampled), ref(words));
+	thread t7(do_sample_work, ref(file_reader), ref(sampled), ref(words));
+	thread t8(do_sample_work, ref(file_reader), ref(sampled), ref(words));
+	t1.join();
+	t2.join();
+	t3.join();
+	t4.join();
+	t5.join();
+	t6.join();
+	t7.join();
+	t8.join();
+	cout << "Finished with first multithreadding..." << endl;
+
+	vector<string> names;
+	vector<double> estimates;
+	vector<vector<double>> replicates;
+	sampled.estimate(sampled_fraction, names, estimates, replicates);
+	cout << "Estimated from " << 100 * sampled_fraction << "% of the file (seed " << seed << "), with " << REPLICATES << " bootstrap replicates:" << endl;
+	print_sampled_toplist(names, estimates, replicates, sampled_fraction, number);
+}
+
+int main(int argc, char* argv[])
+{
+	// --buckets turns on the time-bucketed mode: top lists for every day and week.
+	// --serve keeps the data in memory and answers queries from the standard input.
+	// --input <path>... reads other files, directories or patterns instead of the default file.
+	// --shard <i>/<n> only reads the i-th of n equal parts of the input.
+	// --map <path> writes the partial result to the file instead of printing the list.
+	// --reduce <path>... merges the partial results instead of reading the input.
+	// --sort-based counts the words by sorting instead of sets (see count_by_sorting).
+	// --spill <directory> writes the sorted runs of --sort-based (or the partitions of
+	// --memory-limit) to the disk.
+	// --memory-limit <Mb> spills the largest partitions to the disk above the limit.
+	// --progress <seconds> prints the current top list at every interval while reading.
+	// --sample <fraction> estimates the result from a random part of the file.
+	// --seed <n> draws the blocks of the sample with this seed instead of the default one.
+	// --build-index writes the block index of the input files (see build_index).
+	// --subreddit <name>... only reads the comments of the given subreddits.
+	// --since <date> and --until <date> only read the comments of these days.
+	// --dictionary <path> loads the words frozen by an earlier run (see FrozenDictionary).
+	// --freeze-dictionary <path> writes the words as a frozen dictionary for later runs.
+	auto start = chrono::steady_clock::now();
+	bool bucketed = false;
+	bool sort_based = false;
+	string spill_directory = ".";
+	double sample_fraction = 0;
+	unsigned long long seed = DEFAULT_SEED;
+	bool seeded = false;
+	long long memory_limit = 0;
+	int progress_interval = 0;
+	bool server = false;
+	bool building_index = false;
+	string dictionary_path, freeze_path;
+	LineFilter filter;
+	long long since = LLONG_MIN, until = LLONG_MAX;
+	vector<string> inputs;
+	int shard = 0, shards = 1;
+	string map_path;
+	vector<string> partial_paths;
+	for (int i = 1; i < argc; ++i) {
+		if (string(argv[i]) == "--buckets") {
+			bucketed = true;
+		}
+		else if (string(argv[i]) == "--serve") {
+			server = true;
+		}
+		else if (string(argv[i]) == "--input") {
+			while (i + 1 < argc && string(argv[i + 1]).compare(0, 2, "--") != 0) {
+				inputs.push_back(argv[++i]);
+			}
+		}
+		else if (string(argv[i]) == "--shard" && i + 1 < argc) {
+			if (sscanf(argv[++i], "%d/%d", &shard, &shards) != 2 || shard < 0 || shard >= shards) {
+				cout << "error: --shard expects <i>/<n> with 0 <= i < n" << endl;
+				return 1;
+			}
+		}
+		else if (string(argv[i]) == "--map" && i + 1 < argc) {
+			map_path = argv[++i];
+		}
+		else if (string(argv[i]) == "--reduce") {
+			while (i + 1 < argc && string(argv[i + 1]).compare(0, 2, "--") != 0) {
+				partial_paths.push_back(argv[++i]);
+			}
+		}
+		else if (string(argv[i]) == "--sort-based") {
+			sort_based = true;
+		}
+		else if (string(argv[i]) == "--spill" && i + 1 < argc) {
+			spill_directory = argv[++i];
+		}
+		else if (string(argv[i]) == "--sample" && i + 1 < argc) {
+			sample_fraction = atof(argv[++i]);
+			if (!(sample_fraction > 0 && sample_fraction <= 1)) {
+				cout << "error: --sample expects a fraction between 0 and 1" << endl;
+				return 1;
+			}
+		}
+		else if (string(argv[i]) == "--seed" && i + 1 < argc) {
+			seed = strtoull(argv[++i], nullptr, 10);
+			seeded = true;
+		}
+		else if (string(argv[i]) == "--memory-limit" && i + 1 < argc) {
+			memory_limit = atoll(argv[++i]);
+			if (memory_limit <= 0) {
+				cout << "error: --memory-limit expects a positive number of Mb" << endl;
+				return 1;
+			}
+		}
+		else if (string(argv[i]) == "--progress" && i + 1 < argc) {
+			progress_interval = atoi(argv[++i]);
+			if (progress_interval <= 0) {
+				cout << "error: --progress expects a positive number of seconds" << endl;
+				return 1;
+			}
+		}
+		else if (string(argv[i]) == "--dictionary" && i + 1 < argc) {
+			dictionary_path = argv[++i];
+		}
+		else if (string(argv[i]) == "--freeze-dictionary" && i + 1 < argc) {
+			freeze_path = argv[++i];
+		}
+		else if (string(argv[i]) == "--build-index") {
+			building_index = true;
+		}
+		else if (string(argv[i]) == "--subreddit") {
+			while (i + 1 < argc && string(argv[i + 1]).compare(0, 2, "--") != 0) {
+				filter.add_subreddit(argv[++i]);
+			}
+		}
+		else if ((string(argv[i]) == "--since" || string(argv[i]) == "--until") && i + 1 < argc) {
+			bool is_until = string(argv[i]) == "--until";
+			if (!parse_date(argv[++i], is_until, is_until ? until : since)) {
+				cout << "error: " << argv[i - 1] << " expects a date (YYYY-MM-DD) or a unix timestamp" << endl;
+				return 1;
+			}
+		}
+		else {
+			cout << "error: unknown option " << argv[i] << " (or it's value is missing)" << endl;
+			return 1;
+		}
+	}
+	filter.set_time_range(since, until);
+	// the reducer does not read the input, so there is nothing to filter or index.
+	if (!partial_paths.empty() && (building_index || filter.is_active())) {
+		cout << "error: --build-index, --subreddit, --since and --until can not be used with --reduce" << endl;
+		return 1;
+	}
+	// the partial results do not have days in them.
+	if (bucketed && (!map_path.empty() || !partial_paths.empty())) {
+		cout << "error: --buckets can not be used with --map or --reduce" << endl;
+		return 1;
+	}
+	// the sort-based mode has no sets, so it can only print the list.
+	if (sort_based && (bucketed || server || !map_path.empty() || !partial_paths.empty())) {
+		cout << "error: --sort-based can not be used with --buckets, --serve, --map or --reduce" << endl;
+		return 1;
+	}
+	if (seeded && sample_fraction == 0) {
+		cout << "error: --seed can only be used with --sample" << endl;
+		return 1;
+	}
+	// the sample is only good for a quick preview of the list (and it does not see
+	// every word, so there is nothing to freeze).
+	if (sample_fraction > 0 && (bucketed || sort_based || server || shards != 1 || !map_path.empty() || !partial_paths.empty() || !freeze_path.empty())) {
+		cout << "error: --sample can not be used with --buckets, --sort-based, --serve, --shard, --map, --reduce or --freeze-dictionary" << endl;
+		return 1;
+	}
+	// the spilled partitions are only merged back when the list is printed.
+	if (memory_limit > 0 && (bucketed || sort_based || server || sample_fraction > 0 || !map_path.empty())) {
+		cout << "error: --memory-limit can not be used with --buckets, --sort-based, --serve, --sample or --map" << endl;
+		return 1;
+	}
+	// the running top list needs the sets of the whole input in memory (the days have
+	// their own sets, and a spilled subreddit would start again from 0).
+	if (progress_interval > 0 && (bucketed || sort_based || sample_fraction > 0 || memory_limit > 0)) {
+		cout << "error: --progress can not be used with --buckets, --sort-based, --sample or --memory-limit" << endl;
+		return 1;
+	}
+	// the list of the input files, the default file if there was no --input (the
+	// reducer does not read the input).
+	if (inputs.empty()) {
+		inputs.push_back("C:\\reddit\\reddit");
+	}
+	vector<string> files;
+	for (size_t i = 0; i < inputs.size() && partial_paths.empty(); ++i) {
+		if (!expand_input(inputs[i], files)) {
+			cout << "error: could not open " << inputs[i] << endl;
+			return 1;
+		}
+	}
+	if (files.empty() && partial_paths.empty()) {
+		cout << "error: no input files" << endl;
+		return 1;
+	}
+	if (building_index) {
+		if (!build_index(files)) {
+			return 1;
+		}
+		cout << "Execution time: " << chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start).count() / 1000.0 << " s" << endl;
+		return 0;
+	}
+	// create words map, to map each word to number. We will pass it to each thread.
+	WordsMap words;
+	if (!dictionary_path.empty() && !words.load_frozen(dictionary_path)) {
+		cout << "error: could not load the dictionary " << dictionary_path << endl;
+		return 1;
+	}
+	if (sample_fraction > 0) {
+		estimate_from_sample(files, filter, words, sample_fraction, seed, 10);
+		cout << "Execution time: " << chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start).count() / 1000.0 << " s" << endl;
+		cin.get();
+		return 0;
+	}
+
+	// create subreddits to store each subreddit's vocabulary with mapped words.
+	Subreddits subreddits;
+	if (memory_limit > 0) {
+		subreddits.set_memory_limit(memory_limit << 20, spill_directory);
+	}
+	// daily vocabularies, only used in bucketed mode.
+	BucketedSubreddits buckets;
+	BucketedSubreddits* buckets_ptr = bucketed ? &buckets : nullptr;
+	// the running top list and it's printer, only used in progressive mode.
+	ProgressiveTopList progress(10);
+	thread printer;
+
+	if (sort_based) {
+		SharedFileReader file_reader(files, get_file_ranges(files, shard, shards), filter);
+		if (!file_reader.is_open()) {
+			cout << "error: could not open the input files" << endl;
+			return 1;
+		}
+		if (!count_by_sorting(file_reader, words, spill_directory, 10)) {
+			cout << "error: could not write the sorted runs to " << spill_directory << endl;
+			return 1;
+		}
+		if (!freeze_path.empty() && !words.freeze(freeze_path)) {
+			cout << "error: could not write the dictionary " << freeze_path << endl;
+			return 1;
+		}
+		cout << "Execution time: " << chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start).count() / 1000.0 << " s" << endl;
+		cin.get();
+		return 0;
+	}
+
+	if (progress_interval > 0) {
+		subreddits.set_progress(&progress);
+	}
+
+	if (!partial_paths.empty()) {
+		// reducer: one thread for every partial result, they merge into the same maps.
+		vector<thread> reducers;
+		deque<bool> results(partial_paths.size(), false);
+		if (progress_interval > 0) {
+			printer = thread(do_progress_work, ref(progress), progress_interval, 10);
+		}
+		for (size_t i = 0; i < partial_paths.size(); ++i) {
+			reducers.push_back(thread(do_reduce_work, partial_paths[i], ref(subreddits), ref(words), ref(results[i])));
+		}
+		for (size_t i = 0; i < reducers.size(); ++i) {
+			reducers[i].join();
+			if (!results[i]) {
+				cout << "error: could not read partial result " << partial_paths[i] << endl;
+				return 1;
+			}
+		}
+	}
+	else {
+		// create shared file reader, we will pass it to each thread. 
+		SharedFileReader file_reader(files, get_file_ranges(files, shard, shards), filter);
+		if (!file_reader.is_open()) {
+			cout << "error: could not open the input files" << endl;
+			return 1;
+		}
+
+		if (progress_interval > 0) {
+			printer = thread(do_progress_work, ref(progress), progress_interval, 10);
+		}
+
+		// create four threads. Because this is how much my computer can handle...
+		// pass the shared assets to each of them and the function to execute.
+		thread t1(do_work, ref(file_reader), ref(subreddits), ref(words), buckets_ptr);
+		thread t2(do_work, ref(file_reader), ref(subreddits), ref(words), buckets_ptr);
+		thread t3(do_work, ref(file_reader), ref(subreddits), ref(words), buckets_ptr);
+		thread t4(do_work, ref(file_reader), ref(subreddits), ref(words), buckets_ptr);
+		thread t5(do_work, ref(file_reader), ref(subreddits), ref(words), buckets_ptr);
+		thread t6(do_work, ref(file_reader), ref(subreddits), ref(words), buckets_ptr);
+		thread t7(do_work, ref(file_reader), ref(subreddits), ref(words), buckets_ptr);
+		thread t8(do_work, ref(file_reader), ref(subreddits), ref(words), buckets_ptr);
+		// here we wait for each thread to finish work
+		t1.join();
+		t2.join();
+		t3.join();
+		t4.join();
+		t5.join();
+		t6.join();
+		t7.join();
+		t8.join();
+	}
+	if (progress_interval > 0) {
+		progress.finish();
+		printer.join();
+	}
+	if (!subreddits.spill_ok()) {
+		cout << "error: could not write the spilled partitions to " << spill_directory << endl;
+		return 1;
+	}
+
+	// every word has been seen now, so the dictionary can be frozen for the next runs.
+	if (!freeze_path.empty() && !words.freeze(freeze_path)) {
+		cout << "error: could not write the dictionary " << freeze_path << endl;
+		return 1;
+	}
+
+	// a mapper only writes it's partial result, the reducer will print the list.
+	if (!map_path.empty()) {
+		if (!write_partial(map_path, subreddits, words)) {
+			cout << "error: could not write partial result " << map_path << endl;
+			return 1;
+		}
+		return 0;
+	}
+
+	// in bucketed mode we print every day and week first, and build the whole
+	// file's result from the days.
+	if (bucketed) {
+		buckets.print(10, subreddits);
+		cout << "--- whole file ---" << endl;
+	}
+
+	// in server mode the queries decide what gets printed.
+	if (server) {
+		serve(subreddits, words);
+		return 0;
+	}
+
 	// and in the end we print the most diverse 10 subreddits.
-	subreddits.getMostDiverse(10);
+	if (!subreddits.getMostDiverse(10)) {
+		cout << "error: could not read the spilled partitions from " << spill_directory << endl;
+		return 1;
+	}
+	cout << "Execution time: " << chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start).count() / 1000.0 << " s" << endl;
 
 	// This line waits for an enter press. This way the program does not exits.
 	cin.get();
@@ -3,19 +3,55 @@
 
 #include "stdafx.h"
 #include "json.hpp"
-#include <unordered_map>
-#include <unordered_set>
+#include "flat_hash.h"
+#include "binary_io.h"
+#include "input_reader.h"
+#include "sampling.h"
+#include "frozen_dictionary.h"
+#include "ranking_snapshots.h"
 #include <fstream>
 #include <iostream>
 #include <string>
 #include <regex>
 #include <mutex>
 #include <thread>
+#include <map>
+#include <ctime>
+#include <chrono>
+#include <memory>
+#include <algorithm>
+#include <cstdio>
+#include <deque>
+#include <random>
+#include <numeric>
+#include <cmath>
+#include <atomic>
+#include <climits>
+#include <functional>
 
 
 using namespace std;
 using json = nlohmann::json;
 
+/*
+ * The memory used by the containers, for the memory report of the query server.
+ * memory_of returns the bytes a container (or string) allocates, not counting the
+ * object itself, which is either on the stack or already counted as part of the
+ * slots of the table holding it. Strings only allocate when they don't fit in the
+ * small string buffer.
+ */
+size_t memory_of(const string& s) {
+	return s.capacity() > 15 ? s.capacity() + 1 : 0;
+}
+
+size_t memory_of(const FlatHashSet<long>& set) {
+	return set.memory_usage();
+}
+
+size_t memory_of(const vector<long>& v) {
+	return v.capacity() * sizeof(long);
+}
+
 /*
  * Pair is a class to contain two subreddit's names and the number of their common
  * commenters. 
@@ -24,17 +60,32 @@ class Pair {
 	string subreddit1;
 	string subreddit2;
 	long number_of_common;
+	// only set by the approximate (MinHash) mode, 0 otherwise.
+	double jaccard;
 public:
 	Pair() {
 		subreddit1 = "";
 		subreddit2 = "";
 		number_of_common = 0;
+		jaccard = 0;
 	}
 
 	Pair(string sub1, string sub2, long nr) {
 		subreddit1 = sub1;
 		subreddit2 = sub2;
 		number_of_common = nr;
+		jaccard = 0;
+	}
+
+	Pair(string sub1, string sub2, long nr, double j) {
+		subreddit1 = sub1;
+		subreddit2 = sub2;
+		number_of_common = nr;
+		jaccard = j;
+	}
+
+	double getJaccard() {
+		return jaccard;
 	}
 
 	long getNumberOfCommon() {
@@ -68,6 +119,10 @@ public:
 	// Thread-safe add method. Only one thread can use it at a time.
 	void add(Pair p) {
 		lock_guard<mutex> locker(mu_write);
+		// most pairs are not better than the smallest, they would not move.
+		if (p.getNumberOfCommon() <= toplist[0].getNumberOfCommon()) {
+			return;
+		}
 		for (int i = 0; i < size; ++i) {
 			if (p.getNumberOfCommon() > toplist[i].getNumberOfCommon()) {
 				if (i == 0) {
@@ -84,12 +139,36 @@ public:
 
 	// prints out the elements in the list.
 	void print() {
-		for (int i = 0; i < size; ++i) {
-			cout << toplist[i].getSubreddit1() << ", " << toplist[i].getSubreddit2() << ": " << toplist[i].getNumberOfCommon() << endl;
+		print(size);
+	}
+
+	// prints out only the largest number elements (the end of the list).
+	// The slots which are still empty (there were fewer pairs with common authors) are
+	// not printed.
+	void print(int number) {
+		for (int i = (number < size ? size - number : 0); i < size; ++i) {
+			if (toplist[i].getSubreddit1().empty()) {
+				continue;
+			}
+			cout << toplist[i].getSubreddit1() << ", " << toplist[i].getSubreddit2() << ": " << toplist[i].getNumberOfCommon();
+			if (toplist[i].getJaccard() != 0) {
+				cout << " (jaccard: " << toplist[i].getJaccard() << ")";
+			}
+			cout << endl;
 		}
 	}
 
+	Pair get(int i) {
+		return toplist[i];
+	}
+
+	int getSize() {
+		return size;
+	}
+
+	// thread-safe, the smallest number of common authors on the list.
 	long getSmallest() {
+		lock_guard<mutex> locker(mu_write);
 		return toplist[0].getNumberOfCommon();
 	}
 
@@ -106,19 +185,45 @@ public:
 class AuthorMap {
 	long counter;
 	mutex mu_write;
-	unordered_map<string, long> map;
+	FlatHashMap<string, long> map;
+	// the authors of an earlier run (see load_frozen), they are mapped to 1..n.
+	FrozenDictionary frozen;
 public:
 	// first author's mapped value will be 1.
 	AuthorMap() {
 		counter = 1;
 	}
 
+	/*
+	 * Loads the dictionary frozen by an earlier run on the same data (--dictionary). It's
+	 * authors are looked up without the lock, only the new authors go into the map, with
+	 * the numbers after the frozen ones. Has to be called before the first insert.
+	 */
+	bool load_frozen(string path) {
+		if (!frozen.load(path)) {
+			return false;
+		}
+		counter = frozen.size() + 1;
+		return true;
+	}
+
+	// writes every author (the frozen ones too) as a frozen dictionary for the next runs.
+	bool freeze(string path) {
+		vector<string> authors = get_authors_by_number();
+		authors.erase(authors.begin());
+		return FrozenDictionary::write(path, authors);
+	}
+
 	/*
 	 * This function map's an author to a number and returns the mapped value. If it
 	 * did not existed yet in the map, it adds it first. Thread-safe, only one thread
 	 * can execute it at a time.
 	 */
 	long shared_insert(string key) {
+		long long frozen_number = frozen.find(key);
+		if (frozen_number >= 0) {
+			return frozen_number + 1;
+		}
 		lock_guard<mutex> locker(mu_write);
 		long value = map[key];
 		if (value == 0) {
@@ -128,19 +233,479 @@ public:
 		}
 		return value;
 	}
+
+	long getNumberOfElements() {
+		return frozen.size() + map.size();
+	}
+
+	/*
+	 * returns the authors of the numbers marked in used (used[number] is true), in the order
+	 * of their numbers. With a frozen dictionary most of it's authors are usually not used
+	 * by a part of the input, so they are not copied.
+	 */
+	vector<string> get_used_authors(const vector<bool>& used) {
+		vector<string> authors;
+		for (size_t i = 0; i < frozen.size(); ++i) {
+			if (used[i + 1]) {
+				authors.push_back(frozen.key(i));
+			}
+		}
+		vector<pair<long, string>> others;
+		for (auto element = map.begin(); element != map.end(); ++element) {
+			if (used[element->second]) {
+				others.push_back(make_pair(element->second, element->first));
+			}
+		}
+		sort(others.begin(), others.end());
+		for (const auto& other : others) {
+			authors.push_back(other.second);
+		}
+		return authors;
+	}
+
+	// returns every author at the index of it's mapped number (index 0 is unused).
+	vector<string> get_authors_by_number() {
+		vector<string> authors(counter);
+		for (size_t i = 0; i < frozen.size(); ++i) {
+			authors[i + 1] = frozen.key(i);
+		}
+		for (auto element = map.begin(); element != map.end(); ++element) {
+			authors[element->second] = element->first;
+		}
+		return authors;
+	}
+
+	// number of bytes used by the map (see memory_of), and the frozen dictionary.
+	size_t memory_usage() {
+		size_t bytes = sizeof(map) + map.memory_usage() + frozen.memory_usage();
+		for (auto element = map.begin(); element != map.end(); ++element) {
+			bytes += memory_of(element->first);
+		}
+		return bytes;
+	}
+};
+
+/*
+ * Progressive mode (--progress <seconds>): the current top list is printed at every
+ * interval while the file is still being read, so a long run can be stopped once the
+ * ranking settles. Counting the common authors of every pair while reading would need
+ * the subreddits of every author, so the pairs are estimated from small sketches
+ * instead: every subreddit keeps the SKETCH_SIZE smallest hashes of it's authors (a
+ * bottom-k sketch, which only changes when one of them is beaten), and it's number of
+ * authors is known exactly. The running list has the PROGRESS_CANDIDATES subreddits
+ * with the most authors (the numbers only grow, so a subreddit can only get on it by
+ * growing past the smallest one, and the list is exact), and a snapshot is the list
+ * with the sketches, which gets to the printer through RankingSnapshots. The printer
+ * estimates every pair of the snapshot (see estimate_jaccard_from_sketches), the
+ * common authors are J * (|A| + |B|) / (1 + J) like in the approximate mode.
+ */
+const int SKETCH_SIZE = 64;
+const int PROGRESS_CANDIDATES = 30;
+
+struct SketchedSubreddit {
+	string subreddit;
+	long number_of_authors;
+	vector<unsigned long long> sketch;
+};
+
+/*
+ * The fraction of the SKETCH_SIZE smallest hashes of the two subreddits together which
+ * are in both. These are all in one of the sketches, and if such a hash belongs to an
+ * author of a subreddit, it's in that subreddit's sketch too, so this estimates the
+ * jaccard (exactly, if both have fewer authors than SKETCH_SIZE).
+ */
+double estimate_jaccard_from_sketches(vector<unsigned long long> a, vector<unsigned long long> b) {
+	sort(a.begin(), a.end());
+	sort(b.begin(), b.end());
+	size_t i = 0, j = 0;
+	int seen = 0, both = 0;
+	while (seen < SKETCH_SIZE && (i < a.size() || j < b.size())) {
+		if (j == b.size() || (i < a.size() && a[i] < b[j])) {
+			i++;
+		}
+		else if (i == a.size() || b[j] < a[i]) {
+			j++;
+		}
+		else {
+			both++;
+			i++;
+			j++;
+		}
+		seen++;
+	}
+	return seen == 0 ? 0 : both / (double)seen;
+}
+
+class ProgressiveCommonAuthors {
+	// the sketches are max-heaps, the largest of the smallest hashes is on the top.
+	FlatHashMap<string, vector<unsigned long long>> sketches;
+	vector<pair<string, long>> ranking;
+	long smallest;
+	size_t smallest_index;
+	RankingSnapshots<SketchedSubreddit> snapshots;
+public:
+	ProgressiveCommonAuthors() {
+		smallest = 0;
+		smallest_index = 0;
+	}
+
+	// not thread-safe, called by Subreddits under it's lock for every new author of a subreddit.
+	void update(const string& subreddit, long author_id, long number_of_authors) {
+		vector<unsigned long long>& sketch = sketches[subreddit];
+		unsigned long long author_hash = mix(author_id);
+		if ((int)sketch.size() < SKETCH_SIZE) {
+			sketch.push_back(author_hash);
+			push_heap(sketch.begin(), sketch.end());
+		}
+		else if (author_hash < sketch.front()) {
+			pop_heap(sketch.begin(), sketch.end());
+			sketch.back() = author_hash;
+			push_heap(sketch.begin(), sketch.end());
+		}
+		if ((int)ranking.size() < PROGRESS_CANDIDATES || number_of_authors > smallest) {
+			size_t i = 0;
+			while (i < ranking.size() && ranking[i].first != subreddit) {
+				i++;
+			}
+			if (i == ranking.size() && (int)ranking.size() < PROGRESS_CANDIDATES) {
+				ranking.push_back(make_pair(subreddit, 0L));
+			}
+			else if (i == ranking.size()) {
+				i = smallest_index;
+			}
+			ranking[i] = make_pair(subreddit, number_of_authors);
+			if ((int)ranking.size() == PROGRESS_CANDIDATES) {
+				smallest_index = 0;
+				for (size_t j = 1; j < ranking.size(); ++j) {
+					if (ranking[j].second < ranking[smallest_index].second) {
+						smallest_index = j;
+					}
+				}
+				smallest = ranking[smallest_index].second;
+			}
+		}
+		if (snapshots.is_requested()) {
+			snapshots.publish(get_snapshot());
+		}
+	}
+
+	// the running list with the sketches.
+	vector<SketchedSubreddit> get_snapshot() {
+		vector<SketchedSubreddit> snapshot(ranking.size());
+		for (size_t i = 0; i < ranking.size(); ++i) {
+			snapshot[i].subreddit = ranking[i].first;
+			snapshot[i].number_of_authors = ranking[i].second;
+			snapshot[i].sketch = sketches[ranking[i].first];
+		}
+		return snapshot;
+	}
+
+	// called after the workers are joined, the printer prints the final list last.
+	void finish() {
+		snapshots.finish(get_snapshot());
+	}
+
+	RankingSnapshots<SketchedSubreddit>* get_snapshots() {
+		return &snapshots;
+	}
+};
+
+// the printer thread of the progressive mode, until the snapshots are finished.
+void do_progress_work(ProgressiveCommonAuthors& progress, int interval, int number) {
+	auto start = chrono::steady_clock::now();
+	auto print_snapshot = [&](const vector<SketchedSubreddit>* snapshot, const string& note) {
+		TopList top(number);
+		for (size_t a = 0; a < snapshot->size(); ++a) {
+			for (size_t b = a + 1; b < snapshot->size(); ++b) {
+				const SketchedSubreddit& first = (*snapshot)[a];
+				const SketchedSubreddit& second = (*snapshot)[b];
+				double jaccard = estimate_jaccard_from_sketches(first.sketch, second.sketch);
+				long common = (long)(jaccard * (first.number_of_authors + second.number_of_authors) / (1 + jaccard) + 0.5);
+				top.add(Pair(first.subreddit, second.subreddit, common, jaccard));
+			}
+		}
+		cout << "--- after " << chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start).count() / 1000.0 << " s (" << note << "among the " << PROGRESS_CANDIDATES << " largest subreddits) ---" << endl;
+		top.print();
+	};
+	while (progress.get_snapshots()->wait(chrono::seconds(interval))) {
+		const vector<SketchedSubreddit>* snapshot = progress.get_snapshots()->take(chrono::seconds(interval));
+		if (snapshot != nullptr) {
+			print_snapshot(snapshot, "estimates ");
+		}
+	}
+	const vector<SketchedSubreddit>* snapshot = progress.get_snapshots()->get_final();
+	if (snapshot != nullptr) {
+		print_snapshot(snapshot, "final estimates ");
+	}
+}
+
+/*
+ * Memory limit (--memory-limit): the subreddits are divided into SPILL_PARTITIONS
+ * partitions by the hash of their name. When the authors of the subreddits would use
+ * more memory than the limit, the largest partitions are written to the spill
+ * directory and removed from the memory. The second phase then compares the spilled
+ * partitions block by block (see find_common_authors_spilled), so it finds exactly the
+ * same pairs. The author map is not counted, it has to fit into the memory anyway.
+ */
+const int SPILL_PARTITIONS = 64;
+
+int partition_of(const string& subreddit) {
+	return flat_hash_bytes(subreddit.data(), subreddit.size()) % SPILL_PARTITIONS;
+}
+
+// a spilled partition which is too big for a block is split into pieces by the rest of
+// the same hash (see spill_into_blocks).
+int piece_of(const string& subreddit, int number_of_pieces) {
+	return flat_hash_bytes(subreddit.data(), subreddit.size()) / SPILL_PARTITIONS % number_of_pieces;
+}
+
+// a piece of a spilled partition, written as one run, and the bytes it uses in memory.
+struct SpillPiece {
+	int partition;
+	int piece;
+	size_t bytes;
 };
 
 /*
  * A class to store each subreddit's commenters. We store the commenters in two
- * different data structures. In an unordered_set which gives us really fast 
+ * different data structures. In a FlatHashSet which gives us really fast 
  * lookup (to check if a commenter is in it or not), and in a vector which provi-
  * des quick iteration and the possibility to start from a given index.
  */
 class Subreddits {
 	mutex mu_write;
-	unordered_map<string, unordered_set<long>> map;
-	unordered_map<string, vector<long>> v_map;
+	FlatHashMap<string, FlatHashSet<long>> map;
+	FlatHashMap<string, vector<long>> v_map;
+	// the memory limit in bytes (0 if there is none), the bytes used by the authors of
+	// every partition which are still in memory, the bytes every partition used before
+	// it was spilled, summed over it's runs (see spill_partition), and the pieces of the
+	// spilled partitions (see spill_into_blocks).
+	size_t memory_limit;
+	size_t used;
+	vector<size_t> partition_bytes;
+	vector<size_t> spilled_bytes;
+	vector<SpillPiece> pieces;
+	string spill_directory;
+	bool spill_failed;
+	// the running top list of the progressive mode, null if it's off.
+	ProgressiveCommonAuthors* progress;
+
+	// the bytes of one subreddit: it's slots in the maps, it's name twice and it's authors.
+	size_t entry_bytes(const string& subreddit, const FlatHashSet<long>& authors, const vector<long>& v_authors) {
+		return 2 * (sizeof(string) + memory_of(subreddit)) + sizeof(FlatHashSet<long>) + sizeof(vector<long>) + memory_of(authors) + memory_of(v_authors);
+	}
+
+	string spill_path(int partition) {
+		return spill_file_path(spill_directory, "task2", "partition-" + to_string(partition) + ".spill");
+	}
+
+	string piece_path(const SpillPiece& piece) {
+		return spill_file_path(spill_directory, "task2", "partition-" + to_string(piece.partition) + "-" + to_string(piece.piece) + ".spill");
+	}
+
+	/*
+	 * Reads every run of a spill file, and inserts the subreddits of the given piece (see
+	 * piece_of) here. The runs of the same subreddit are merged by shared_insert_all.
+	 */
+	bool read_runs(string path, int piece, int number_of_pieces) {
+		ifstream in(path, ios::binary);
+		while (in.good() && in.peek() != EOF) {
+			unsigned long long number_of_subreddits = read_length(in);
+			for (unsigned long long i = 0; i < number_of_subreddits && in.good(); ++i) {
+				string subreddit = read_string(in);
+				vector<long> author_ids = read_numbers(in);
+				if (in.good() && piece_of(subreddit, number_of_pieces) == piece) {
+					shared_insert_all(subreddit, author_ids);
+				}
+			}
+		}
+		return !in.fail();
+	}
+
+	// writes every subreddit into a new file, as one run (see spill_partition).
+	bool write_run(string path) {
+		vector<string> names;
+		for (auto element = v_map.begin(); element != v_map.end(); ++element) {
+			names.push_back(element->first);
+		}
+		sort(names.begin(), names.end());
+		ofstream out(path, ios::binary);
+		write_varint(out, names.size());
+		for (const auto& name : names) {
+			write_string(out, name);
+			write_numbers(out, v_map[name]);
+		}
+		return out.good();
+	}
+
+	/*
+	 * Adds the growth of a subreddit's authors to it's partition. If the subreddits use
+	 * more than the limit now, the largest partitions are spilled until they use less
+	 * than 3/4 of it, so we don't spill again right after the next few authors.
+	 */
+	void account(const string& subreddit, size_t before, size_t after) {
+		if (memory_limit == 0) {
+			return;
+		}
+		partition_bytes[partition_of(subreddit)] += after - before;
+		used += after - before;
+		if (used <= memory_limit) {
+			return;
+		}
+		while (used > memory_limit / 4 * 3) {
+			int largest = max_element(partition_bytes.begin(), partition_bytes.end()) - partition_bytes.begin();
+			if (partition_bytes[largest] == 0) {
+				break;
+			}
+			spill_partition(largest);
+		}
+	}
+
+	/*
+	 * Appends every subreddit of the partition to it's spill file (a run: the number of
+	 * subreddits, then the subreddits sorted by name, each with it's sorted authors),
+	 * and removes them from the memory. The subreddits of a spilled partition can come
+	 * again later, they are collected in memory again, and they may be spilled again
+	 * as an other run of the same file.
+	 */
+	void spill_partition(int partition) {
+		vector<string> names;
+		for (auto element = v_map.begin(); element != v_map.end(); ++element) {
+			if (partition_of(element->first) == partition) {
+				names.push_back(element->first);
+			}
+		}
+		sort(names.begin(), names.end());
+		ofstream out(spill_path(partition), ios::binary | (spilled_bytes[partition] == 0 ? ios::trunc : ios::app));
+		write_varint(out, names.size());
+		for (const auto& name : names) {
+			write_string(out, name);
+			write_numbers(out, v_map[name]);
+			v_map.erase(name);
+			map.erase(name);
+		}
+		spill_failed = spill_failed || !out.good();
+		cout << "spilled partition " << partition << ": " << names.size() << " subreddits, " << partition_bytes[partition] / (1 << 20) << " Mb" << endl;
+		used -= partition_bytes[partition];
+		spilled_bytes[partition] += partition_bytes[partition];
+		partition_bytes[partition] = 0;
+	}
 public:
+	Subreddits() {
+		memory_limit = 0;
+		used = 0;
+		spill_failed = false;
+		progress = nullptr;
+	}
+
+	// turns on the progressive mode, has to be called before the first insert.
+	void set_progress(ProgressiveCommonAuthors* progress_in) {
+		progress = progress_in;
+	}
+
+	/*
+	 * Limits the memory used by the subreddits (--memory-limit). Over the limit the
+	 * largest partitions are written to the directory. Has to be called before the
+	 * first insert.
+	 */
+	void set_memory_limit(size_t limit, string directory) {
+		memory_limit = limit;
+		spill_directory = directory;
+		partition_bytes.assign(SPILL_PARTITIONS, 0);
+		spilled_bytes.assign(SPILL_PARTITIONS, 0);
+	}
+
+	size_t getMemoryLimit() {
+		return memory_limit;
+	}
+
+	// false if a spill file could not be written.
+	bool spill_ok() {
+		return !spill_failed;
+	}
+
+	bool has_spilled() {
+		for (int partition = 0; partition < SPILL_PARTITIONS && memory_limit != 0; ++partition) {
+			if (spilled_bytes[partition] != 0) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	/*
+	 * Spills the rest of the partitions as well, so every subreddit is on the disk, and
+	 * groups them into blocks which use at most half of the limit each, so two blocks fit
+	 * into the memory at the same time. The bytes counted while spilling are summed over
+	 * the runs, a subreddit spilled in several runs is counted in each, so they are only
+	 * an upper bound. Every partition is compacted first: it's split into as many pieces
+	 * as that upper bound needs to be under half of the limit (by the rest of the hash of
+	 * the names, see piece_of), every piece is read back and merged alone, measured, and
+	 * written as a single run. The pieces are packed into the blocks by their measured
+	 * size. A piece can still be over half of the limit if a single subreddit is that
+	 * big, this is reported, as two such blocks do not fit into the limit.
+	 * Not thread-safe, only used after the data gathering.
+	 */
+	vector<vector<int>> spill_into_blocks() {
+		for (int partition = 0; partition < SPILL_PARTITIONS; ++partition) {
+			if (partition_bytes[partition] != 0) {
+				spill_partition(partition);
+			}
+		}
+		size_t half = memory_limit / 2;
+		for (int partition = 0; partition < SPILL_PARTITIONS && !spill_failed; ++partition) {
+			if (spilled_bytes[partition] == 0) {
+				continue;
+			}
+			int number_of_pieces = (int)((spilled_bytes[partition] - 1) / half + 1);
+			for (int i = 0; i < number_of_pieces && !spill_failed; ++i) {
+				Subreddits compacted;
+				SpillPiece piece;
+				piece.partition = partition;
+				piece.piece = i;
+				spill_failed = !compacted.read_runs(spill_path(partition), i, number_of_pieces);
+				piece.bytes = compacted.set_memory_usage() + compacted.vector_memory_usage();
+				spill_failed = spill_failed || !compacted.write_run(piece_path(piece));
+				pieces.push_back(piece);
+				if (piece.bytes > half) {
+					cout << "warning: piece " << i << " of partition " << partition << " uses " << piece.bytes / (1 << 20) << " Mb, more than half of the memory limit, so two blocks may not fit into it" << endl;
+				}
+			}
+			remove(spill_path(partition).c_str());
+		}
+		vector<vector<int>> blocks;
+		size_t block_bytes = 0;
+		for (size_t i = 0; i < pieces.size(); ++i) {
+			if (blocks.empty() || block_bytes + pieces[i].bytes > half) {
+				blocks.push_back(vector<int>());
+				block_bytes = 0;
+			}
+			blocks.back().push_back(i);
+			block_bytes += pieces[i].bytes;
+		}
+		return blocks;
+	}
+
+	// reads the pieces of a block (see spill_into_blocks) into an other (empty) Subreddits.
+	bool load_spilled(const vector<int>& block_pieces, Subreddits& block) {
+		bool ok = true;
+		for (const auto& piece : block_pieces) {
+			ok = ok && block.read_runs(piece_path(pieces[piece]), 0, 1);
+		}
+		return ok;
+	}
+
+	// removes the spill files, after the second phase.
+	void remove_spilled() {
+		for (int partition = 0; partition < SPILL_PARTITIONS && memory_limit != 0; ++partition) {
+			if (spilled_bytes[partition] != 0) {
+				remove(spill_path(partition).c_str());
+			}
+		}
+		for (const auto& piece : pieces) {
+			remove(piece_path(piece).c_str());
+		}
+	}
 
 	/*
 	 * Thread safe addition of a subreddit and a commenter (author). It creates the
@@ -150,60 +715,274 @@ public:
 	 */
 	void shared_insert(string subreddit, long author_id) {
 		lock_guard<mutex> locker(mu_write);
+		size_t before = 0;
 		if (map.count(subreddit) == 0) {
 			vector<long> v_tmp;
-			unordered_set<long> tmp;
+			FlatHashSet<long> tmp;
 			v_map[subreddit] = v_tmp;
 			map[subreddit] = tmp;
 		}
 		else {
-			if (map[subreddit].count(author_id) == 0) {
-				v_map[subreddit].push_back(author_id);
-				map[subreddit].insert(author_id);
+			before = entry_bytes(subreddit, map[subreddit], v_map[subreddit]);
+		}
+		if (map[subreddit].count(author_id) == 0) {
+			v_map[subreddit].push_back(author_id);
+			map[subreddit].insert(author_id);
+			if (progress != nullptr) {
+				progress->update(subreddit, author_id, v_map[subreddit].size());
+			}
+			account(subreddit, before, entry_bytes(subreddit, map[subreddit], v_map[subreddit]));
+		}
+	}
+
+	/*
+	 * Adds every author of an other Subreddits object to this one (to both data
+	 * structures). The authors are mapped by the same AuthorMap everywhere, so the
+	 * result is the same as if the comments of both had been inserted here. Not
+	 * thread-safe, only used after the data gathering.
+	 */
+	void merge(Subreddits& other) {
+		for (auto element = other.v_map.begin(); element != other.v_map.end(); ++element) {
+			FlatHashSet<long>& authors = map[element->first];
+			vector<long>& v_authors = v_map[element->first];
+			for (const auto& author_id : element->second) {
+				if (authors.insert(author_id).second) {
+					v_authors.push_back(author_id);
+				}
+			}
+		}
+	}
+
+	// same as shared_insert, but for many authors at once, so we only lock once.
+	void shared_insert_all(string subreddit, const vector<long>& author_ids) {
+		lock_guard<mutex> locker(mu_write);
+		FlatHashSet<long>& authors = map[subreddit];
+		vector<long>& v_authors = v_map[subreddit];
+		size_t before = authors.empty() ? 0 : entry_bytes(subreddit, authors, v_authors);
+		for (const auto& author_id : author_ids) {
+			if (authors.insert(author_id).second) {
+				v_authors.push_back(author_id);
+				if (progress != nullptr) {
+					progress->update(subreddit, author_id, v_authors.size());
+				}
+			}
+		}
+		account(subreddit, before, entry_bytes(subreddit, authors, v_authors));
+	}
+
+	bool contains(string subreddit) {
+		return map.count(subreddit) != 0;
+	}
+
+	long getNumberOfAuthors(string subreddit) {
+		return v_map[subreddit].size();
+	}
+
+	/*
+	 * Counts the common authors of two subreddits. We iterate over the smaller one's
+	 * vector and look up in the bigger one's set, so it's fast enough for a single pair
+	 * query, without running the whole second phase.
+	 */
+	long getNumberOfCommon(string subreddit1, string subreddit2) {
+		vector<long>* small = &v_map[subreddit1];
+		FlatHashSet<long>* big = &map[subreddit2];
+		if (small->size() > big->size()) {
+			small = &v_map[subreddit2];
+			big = &map[subreddit1];
+		}
+		long common_authors = 0;
+		for (const auto& author_id : *small) {
+			if (big->count(author_id) != 0) {
+				common_authors++;
 			}
 		}
+		return common_authors;
+	}
+
+	long getNumberOfSubreddits() {
+		return map.size();
+	}
+
+	// number of bytes used by the sets and by the vectors (see memory_of).
+	size_t set_memory_usage() {
+		size_t bytes = sizeof(map) + map.memory_usage();
+		for (auto element = map.begin(); element != map.end(); ++element) {
+			bytes += memory_of(element->first) + memory_of(element->second);
+		}
+		return bytes;
+	}
+
+	size_t vector_memory_usage() {
+		size_t bytes = sizeof(v_map) + v_map.memory_usage();
+		for (auto element = v_map.begin(); element != v_map.end(); ++element) {
+			bytes += memory_of(element->first) + memory_of(element->second);
+		}
+		return bytes;
 	}
 
-	unordered_set<long> getActorsForSubreddit(string subreddit) {
+	FlatHashSet<long> getActorsForSubreddit(string subreddit) {
 		return map[subreddit];
 	}
 
-	unordered_map<string, unordered_set<long>>* getSubreddits() {
+	FlatHashMap<string, FlatHashSet<long>>* getSubreddits() {
 		return &map;
 	}
 
-	unordered_map<string, vector<long>>* getSubredditsVect() {
+	FlatHashMap<string, vector<long>>* getSubredditsVect() {
 		return &v_map;
 	}
 };
 
 /*
- * This class is responsible for a thread-safe way of reading in lines from the file.
- * It contains a thread safe method which reads in a new line from the file until it
- * reaches it's end.
+ * Helpers for the time-bucketed mode. A bucket is just the number of days (or weeks)
+ * elapsed since 1970-01-01, computed from the created_utc field of the comment. Weeks
+ * start on monday (1970-01-01 was a thursday, hence the +3).
+ */
+long get_created_utc(json& json_line) {
+	// older dumps store the timestamp as a string, newer ones as a number...
+	if (json_line["created_utc"].is_string()) {
+		return stol(json_line["created_utc"].get<string>());
+	}
+	return json_line["created_utc"].get<long>();
+}
+
+long day_of(long created_utc) {
+	return created_utc / 86400;
+}
+
+long week_of_day(long day) {
+	return (day + 3) / 7;
+}
+
+// prints a day bucket as YYYY-MM-DD, so the output is readable.
+string day_label(long day) {
+	time_t t = day * 86400;
+	char buffer[16];
+	strftime(buffer, sizeof(buffer), "%Y-%m-%d", gmtime(&t));
+	return string(buffer);
+}
+
+/*
+ * BucketedSubreddits stores a separate Subreddits object for every day. Every day
+ * uses the same AuthorMap, so author names are only stored once no matter how many
+ * buckets there are. Since the set of authors of a longer window is the union of the
+ * daily sets, weeks (and the whole file) are built by merging days, without reading
+ * the file again.
  */
-class SharedFileReader {
-	mutex mu_read, mu_write;
-	ifstream input;
+class BucketedSubreddits {
+	mutex mu_write;
+	// std::map so the buckets are processed in chronological order.
+	map<long, Subreddits> days;
 public:
-	SharedFileReader() {
-		input = ifstream("C:\\reddit\\reddit");
+	// thread-safe, creates the day if it did not exist yet.
+	void shared_insert(long day, string subreddit, long author_id) {
+		Subreddits* bucket;
+		{
+			lock_guard<mutex> locker(mu_write);
+			bucket = &days[day];
+		}
+		// Subreddits::shared_insert has it's own lock, and map nodes never move.
+		bucket->shared_insert(subreddit, author_id);
 	}
 
-	// Thread safe readline. Only one thread at a time.
-	basic_istream<char>& shared_read(string& line) {
-		lock_guard<mutex> locker(mu_read);
-		return getline(input, line);
+	map<long, Subreddits>* getDays() {
+		return &days;
+	}
+
+	/*
+	 * Builds the weeks one at a time, gives every week to print_week, and merges the days
+	 * into total (the whole file) on the way. A day is removed as soon as it's in it's
+	 * week and in the total, so only one week is in memory besides the days, and the
+	 * days shrink while the total grows. The days are gone after this.
+	 */
+	void merge_weeks(Subreddits& total, function<void(long, Subreddits&)> print_week) {
+		auto day = days.begin();
+		while (day != days.end()) {
+			long week = week_of_day(day->first);
+			Subreddits week_subreddits;
+			for (; day != days.end() && week_of_day(day->first) == week; day = days.erase(day)) {
+				week_subreddits.merge(day->second);
+				total.merge(day->second);
+			}
+			print_week(week, week_subreddits);
+		}
 	}
+};
 
-	// This is just a thread-safe print for debugging purposes.
-	void shared_print(string line) {
-		lock_guard<mutex> locker2(mu_write);
-		cout << line << endl;
+const string PARTIAL_MAGIC = "bigdata-challenge-2 task2 partial v1";
+
+/*
+ * A partial result contains the authors used by the process's subreddits (in the
+ * order of their numbers, they get the local numbers 1, 2, ...), and every
+ * subreddit's authors with these local numbers. The other authors are left out, so
+ * with --dictionary a partial does not contain the whole frozen dictionary.
+ */
+bool write_partial(string path, Subreddits& subreddits, AuthorMap& authors) {
+	ofstream out(path, ios::binary);
+	write_string(out, PARTIAL_MAGIC);
+	vector<bool> used(authors.getNumberOfElements() + 1, false);
+	for (auto element = subreddits.getSubredditsVect()->begin(); element != subreddits.getSubredditsVect()->end(); ++element) {
+		for (const auto& author_id : element->second) {
+			used[author_id] = true;
+		}
+	}
+	vector<long> local(used.size(), 0);
+	long next = 1;
+	for (size_t author_id = 1; author_id < used.size(); ++author_id) {
+		if (used[author_id]) {
+			local[author_id] = next++;
+		}
 	}
+	vector<string> used_authors = authors.get_used_authors(used);
+	write_varint(out, used_authors.size() + 1);
+	for (const auto& author : used_authors) {
+		write_string(out, author);
+	}
+	write_varint(out, subreddits.getSubredditsVect()->size());
+	for (auto element = subreddits.getSubredditsVect()->begin(); element != subreddits.getSubredditsVect()->end(); ++element) {
+		write_string(out, element->first);
+		vector<long> author_ids;
+		for (const auto& author_id : element->second) {
+			author_ids.push_back(local[author_id]);
+		}
+		write_numbers(out, author_ids);
+	}
+	return out.good();
+}
 
+/*
+ * Reads a partial result and merges it into the subreddits. The local author numbers
+ * of the partial are remapped to our own numbers through the (shared) author map first.
+ * Thread-safe, so several partials can be read at the same time.
+ */
+bool read_partial(string path, Subreddits& subreddits, AuthorMap& authors) {
+	ifstream in(path, ios::binary);
+	if (read_string(in) != PARTIAL_MAGIC) {
+		return false;
+	}
+	vector<long> remap(read_length(in));
+	for (size_t i = 1; i < remap.size() && in.good(); ++i) {
+		remap[i] = authors.shared_insert(read_string(in));
+	}
+	unsigned long long number_of_subreddits = read_length(in);
+	for (unsigned long long i = 0; i < number_of_subreddits && in.good(); ++i) {
+		string subreddit = read_string(in);
+		vector<long> author_ids = read_numbers(in);
+		for (auto& author_id : author_ids) {
+			if (author_id < 0 || author_id >= (long)remap.size()) {
+				return false;
+			}
+			author_id = remap[author_id];
+		}
+		subreddits.shared_insert_all(subreddit, author_ids);
+	}
+	return in.good();
+}
 
-};
+// the thread function of the reducer, reads one partial result.
+void do_reduce_work(string path, Subreddits& subreddits, AuthorMap& authors, bool& ok) {
+	ok = read_partial(path, subreddits, authors);
+}
 
 /*
  * This class is responsible of providing a thread-safe method for each thread to get
@@ -214,7 +993,7 @@ public:
 class SharedVectorReader {
 	mutex mu_read;
 	Subreddits* subreddits;
-	unordered_map<string, vector<long>>::iterator subreddit_v_iterator;
+	FlatHashMap<string, vector<long>>::iterator subreddit_v_iterator;
 public:
 	SharedVectorReader(Subreddits* s) {
 		subreddits = s;
@@ -232,20 +1011,148 @@ public:
 };
 
 /*
- * This is the data-gathering function that all the thread's execute until they reach the
- * end of the file. 
- *   1. read in the next line from the file (thread-safe with SharedFileReader)
- *   2. JSON parse it and get the author's name as well as the subreddit's name.
- *   3. Map the author's name to a number value for memory efficiency.
- *   4. Add the author to the subreddit.
+ * Neighbour lists (--neighbours): besides the global toplist, every subreddit gets the
+ * list of the NEIGHBOURS subreddits it has the most common authors with, for
+ * recommendations. They are filled in the same second phase, every pair is added to
+ * the lists of both it's subreddits. Every list is a small min-heap (the weakest
+ * neighbour is on the top, so it can be replaced quickly) with it's own lock, so the
+ * threads only wait for each other if they happen to update the same subreddit's list
+ * at the same time, there is no global lock.
  */
-void do_work(SharedFileReader& reader, Subreddits& subreddits, AuthorMap& authors) {
-	for (string line; reader.shared_read(line); ) {
-		auto json_line = json::parse(line.c_str());
-		string subreddit = json_line["subreddit"];
-		string author = json_line["author"];
+const int NEIGHBOURS = 10;
+const string NEIGHBOURS_MAGIC = "bigdata-challenge-2 task2 neighbours v1";
+
+// the better neighbour has more common authors, then a bigger jaccard, then a smaller name.
+bool is_better_neighbour(Pair& a, Pair& b) {
+	if (a.getNumberOfCommon() != b.getNumberOfCommon()) {
+		return a.getNumberOfCommon() > b.getNumberOfCommon();
+	}
+	if (a.getJaccard() != b.getJaccard()) {
+		return a.getJaccard() > b.getJaccard();
+	}
+	return a.getSubreddit2() < b.getSubreddit2();
+}
+
+class NeighbourLists {
+	struct List {
+		mutex mu_write;
+		// subreddit1 is the owner of the list, subreddit2 the neighbour.
+		vector<Pair> neighbours;
+	};
+	int size;
+	// created for every subreddit before the second phase, so the map itself is only
+	// read by the threads.
+	FlatHashMap<string, unique_ptr<List>> lists;
+
+	// thread-safe for the given subreddit's list.
+	void add(string subreddit, string neighbour, long common, double jaccard) {
+		List& list = *lists.at(subreddit);
+		Pair p(subreddit, neighbour, common, jaccard);
+		lock_guard<mutex> locker(list.mu_write);
+		if ((int)list.neighbours.size() < size) {
+			list.neighbours.push_back(p);
+			push_heap(list.neighbours.begin(), list.neighbours.end(), is_better_neighbour);
+		}
+		else if (is_better_neighbour(p, list.neighbours.front())) {
+			pop_heap(list.neighbours.begin(), list.neighbours.end(), is_better_neighbour);
+			list.neighbours.back() = p;
+			push_heap(list.neighbours.begin(), list.neighbours.end(), is_better_neighbour);
+		}
+	}
+public:
+	NeighbourLists(int s, Subreddits& subreddits) {
+		size = s;
+		lists.reserve(subreddits.getNumberOfSubreddits());
+		for (auto element = subreddits.getSubredditsVect()->begin(); element != subreddits.getSubredditsVect()->end(); ++element) {
+			lists[element->first].reset(new List);
+		}
+	}
+
+	/*
+	 * Adds a pair to both subreddit's lists (if it's good enough for them). Subreddits
+	 * without common authors are not neighbours.
+	 */
+	void add(string subreddit1, long authors1, string subreddit2, long authors2, long common) {
+		if (common == 0) {
+			return;
+		}
+		double jaccard = (double)common / (authors1 + authors2 - common);
+		add(subreddit1, subreddit2, common, jaccard);
+		add(subreddit2, subreddit1, common, jaccard);
+	}
+
+	/*
+	 * Writes every list, the best neighbour first. If the path ends with .csv, it's a
+	 * csv file with a line for every neighbour (subreddit,rank,neighbour,common,jaccard),
+	 * otherwise it's the compact binary format of the partial results: the magic, the
+	 * names of the subreddits, then for every subreddit (in the same order) it's number
+	 * of authors, the length of it's list, and the number of each neighbour's name with
+	 * the number of common authors. The jaccard can be computed from these as
+	 * common / (authors + neighbour's authors - common).
+	 * Not thread-safe, only used after the second phase.
+	 */
+	bool write(string path, Subreddits& subreddits) {
+		vector<string> names;
+		FlatHashMap<string, long> numbers;
+		for (auto list = lists.begin(); list != lists.end(); ++list) {
+			sort_heap(list->second->neighbours.begin(), list->second->neighbours.end(), is_better_neighbour);
+			numbers[list->first] = names.size();
+			names.push_back(list->first);
+		}
+		bool csv = path.size() >= 4 && path.compare(path.size() - 4, 4, ".csv") == 0;
+		ofstream out(path, csv ? ios::out : ios::binary);
+		if (csv) {
+			out << "subreddit,rank,neighbour,common,jaccard" << endl;
+		}
+		else {
+			write_string(out, NEIGHBOURS_MAGIC);
+			write_varint(out, names.size());
+			for (const auto& name : names) {
+				write_string(out, name);
+			}
+		}
+		for (const auto& name : names) {
+			vector<Pair>& neighbours = lists[name]->neighbours;
+			if (!csv) {
+				write_varint(out, subreddits.getNumberOfAuthors(name));
+				write_varint(out, neighbours.size());
+			}
+			for (size_t i = 0; i < neighbours.size(); ++i) {
+				if (csv) {
+					out << name << "," << i + 1 << "," << neighbours[i].getSubreddit2() << "," << neighbours[i].getNumberOfCommon() << "," << neighbours[i].getJaccard() << "\n";
+				}
+				else {
+					write_varint(out, numbers[neighbours[i].getSubreddit2()]);
+					write_varint(out, neighbours[i].getNumberOfCommon());
+				}
+			}
+		}
+		return out.good();
+	}
+};
+
+/*
+ * This is the data-gathering function that all the thread's execute until they reach the
+ * end of the file. 
+ *   1. read in the next line from the file (thread-safe with SharedFileReader)
+ *   2. JSON parse it and get the author's name as well as the subreddit's name.
+ *   3. Map the author's name to a number value for memory efficiency.
+ *   4. Add the author to the subreddit.
+ */
+// If buckets is not null, the author goes into the day of the comment instead of the
+// global subreddits (which will be built from the days in the end).
+void do_work(SharedFileReader& reader, Subreddits& subreddits, AuthorMap& authors, BucketedSubreddits* buckets) {
+	for (string line; reader.shared_read(line); ) {
+		auto json_line = json::parse(line.c_str());
+		string subreddit = json_line["subreddit"];
+		string author = json_line["author"];
 		long auth_id = authors.shared_insert(author);
-		subreddits.shared_insert(subreddit, auth_id);
+		if (buckets != nullptr) {
+			buckets->shared_insert(day_of(get_created_utc(json_line)), subreddit, auth_id);
+		}
+		else {
+			subreddits.shared_insert(subreddit, auth_id);
+		}
 	}
 
 }
@@ -258,8 +1165,9 @@ void do_work(SharedFileReader& reader, Subreddits& subreddits, AuthorMap& author
  *   2. check each subreddit after(!) this one for common authors.
  *   3. for each subreddit pair, add the number of common authors to the toplist
  *        - it will only going to be added if it is big enough to be on the toplist.
+ *        - if neighbours is not null, also to the neighbour lists of both subreddits.
  */
-void do_sorting_work(SharedVectorReader& reader, Subreddits& subreddits, TopList& top) {
+void do_sorting_work(SharedVectorReader& reader, Subreddits& subreddits, TopList& top, NeighbourLists* neighbours) {
 	// getting the next subreddit in the line in a thread-safe manner (through SharedVectorReader)
 	// we get a map with a key of the name of the subreddit and a value of a vector of author ids.
 	/* this function could be optimised with providing a vector iterator here...*/
@@ -275,7 +1183,7 @@ void do_sorting_work(SharedVectorReader& reader, Subreddits& subreddits, TopList
 
 			// we grab the set of actors for the inner subreddit, because the lookup is much faster in
 			// the set. 
-			unordered_set<long> subreddit_in_authors = subreddits.getActorsForSubreddit(subreddit_in_name);
+			FlatHashSet<long> subreddit_in_authors = subreddits.getActorsForSubreddit(subreddit_in_name);
 			if (subreddit_in_name != subreddit_name) {
 
 				// counting common authors.
@@ -291,50 +1199,31 @@ void do_sorting_work(SharedVectorReader& reader, Subreddits& subreddits, TopList
 				// in a thread-safe way (top.add is threadsafe).
 				Pair p(subreddit_name, subreddit_in_name, common_authors);
 				top.add(p);
+				if (neighbours != nullptr) {
+					neighbours->add(subreddit_name, subreddit_authors.size(), subreddit_in_name, subreddit_in_authors.size(), common_authors);
+				}
 			}
 		}
 	}
 	
 }
 
-int main()
-{
-	// create assets and add their references to the threads. 
-	SharedFileReader file_reader;
-	AuthorMap authors;
-	Subreddits subreddits;
-	// first part, only gathering the data
-	thread t1(do_work, ref(file_reader), ref(subreddits), ref(authors));
-	thread t2(do_work, ref(file_reader), ref(subreddits), ref(authors));
-	thread t3(do_work, ref(file_reader), ref(subreddits), ref(authors));
-	thread t4(do_work, ref(file_reader), ref(subreddits), ref(authors));
-	thread t5(do_work, ref(file_reader), ref(subreddits), ref(authors));
-	thread t6(do_work, ref(file_reader), ref(subreddits), ref(authors));
-	thread t7(do_work, ref(file_reader), ref(subreddits), ref(authors));
-	thread t8(do_work, ref(file_reader), ref(subreddits), ref(authors));
-	// waiting for each thread to finish.
-	t1.join();
-	t2.join();
-	t3.join();
-	t4.join();
-	t5.join();
-	t6.join();
-	t7.join();
-	t8.join();
-	cout << "Finished with first multithreadding..." << endl;
-
+/*
+ * Runs the second phase on the given subreddits with 8 threads, and fills the toplist
+ * with the pairs having the most common authors (and the neighbour lists, if not null).
+ */
+void find_common_authors(Subreddits& subreddits, TopList& top, NeighbourLists* neighbours = nullptr) {
 	// creating assets and adding their reference to the threads in the second phase
 	SharedVectorReader vector_reader(&subreddits);
-	TopList top(10);
 
-	thread t11(do_sorting_work, ref(vector_reader), ref(subreddits), ref(top));
-	thread t12(do_sorting_work, ref(vector_reader), ref(subreddits), ref(top));
-	thread t13(do_sorting_work, ref(vector_reader), ref(subreddits), ref(top));
-	thread t14(do_sorting_work, ref(vector_reader), ref(subreddits), ref(top));
-	thread t15(do_sorting_work, ref(vector_reader), ref(subreddits), ref(top));
-	thread t16(do_sorting_work, ref(vector_reader), ref(subreddits), ref(top));
-	thread t17(do_sorting_work, ref(vector_reader), ref(subreddits), ref(top));
-	thread t18(do_sorting_work, ref(vector_reader), ref(subreddits), ref(top));
+	thread t11(do_sorting_work, ref(vector_reader), ref(subreddits), ref(top), neighbours);
+	thread t12(do_sorting_work, ref(vector_reader), ref(subreddits), ref(top), neighbours);
+	thread t13(do_sorting_work, ref(vector_reader), ref(subreddits), ref(top), neighbours);
+	thread t14(do_sorting_work, ref(vector_reader), ref(subreddits), ref(top), neighbours);
+	thread t15(do_sorting_work, ref(vector_reader), ref(subreddits), ref(top), neighbours);
+	thread t16(do_sorting_work, ref(vector_reader), ref(subreddits), ref(top), neighbours);
+	thread t17(do_sorting_work, ref(vector_reader), ref(subreddits), ref(top), neighbours);
+	thread t18(do_sorting_work, ref(vector_reader), ref(subreddits), ref(top), neighbours);
 
 	// waiting for the threads to finish
 	t11.join();
@@ -346,6 +1235,1016 @@ int main()
 	t17.join();
 	t18.join();
 	cout << "Finished with second multithreadding..." << endl;
+}
+
+/*
+ * The second phase for the pairs of two different blocks of spilled partitions (see
+ * find_common_authors_spilled): every subreddit of the first block (from the reader)
+ * is compared with every subreddit of the other block.
+ */
+void do_cross_work(SharedVectorReader& reader, Subreddits& subreddits, Subreddits& others, TopList& top) {
+	for (auto subreddit = reader.getNext(); subreddit != subreddits.getSubredditsVect()->end(); subreddit = reader.getNext()) {
+		for (auto subreddit_in = others.getSubreddits()->begin(); subreddit_in != others.getSubreddits()->end(); ++subreddit_in) {
+			long common_authors = 0;
+			for (const auto& author_id : subreddit->second) {
+				if (subreddit_in->second.count(author_id) != 0) {
+					common_authors++;
+				}
+			}
+			top.add(Pair(subreddit->first, subreddit_in->first, common_authors));
+		}
+	}
+}
+
+void find_common_authors_between(Subreddits& subreddits, Subreddits& others, TopList& top) {
+	SharedVectorReader vector_reader(&subreddits);
+
+	thread t11(do_cross_work, ref(vector_reader), ref(subreddits), ref(others), ref(top));
+	thread t12(do_cross_work, ref(vector_reader), ref(subreddits), ref(others), ref(top));
+	thread t13(do_cross_work, ref(vector_reader), ref(subreddits), ref(others), ref(top));
+	thread t14(do_cross_work, ref(vector_reader), ref(subreddits), ref(others), ref(top));
+	thread t15(do_cross_work, ref(vector_reader), ref(subreddits), ref(others), ref(top));
+	thread t16(do_cross_work, ref(vector_reader), ref(subreddits), ref(others), ref(top));
+	thread t17(do_cross_work, ref(vector_reader), ref(subreddits), ref(others), ref(top));
+	thread t18(do_cross_work, ref(vector_reader), ref(subreddits), ref(others), ref(top));
+
+	t11.join();
+	t12.join();
+	t13.join();
+	t14.join();
+	t15.join();
+	t16.join();
+	t17.join();
+	t18.join();
+}
+
+/*
+ * The second phase with a memory limit, if partitions had to be spilled. Every
+ * subreddit goes to the disk, and the blocks of partitions (see spill_into_blocks) are
+ * compared like a block nested loop join: a block is read back, the pairs inside it
+ * are compared by the normal second phase, then every later block is read back one by
+ * one, and compared with it. So every pair is compared exactly once (with the same
+ * authors), only two blocks are in memory at the same time, and the later blocks are
+ * read once for every earlier block.
+ */
+bool find_common_authors_spilled(Subreddits& subreddits, TopList& top) {
+	vector<vector<int>> blocks = subreddits.spill_into_blocks();
+	bool ok = subreddits.spill_ok();
+	for (size_t i = 0; i < blocks.size() && ok; ++i) {
+		Subreddits block;
+		ok = subreddits.load_spilled(blocks[i], block);
+		find_common_authors(block, top);
+		for (size_t j = i + 1; j < blocks.size() && ok; ++j) {
+			Subreddits other;
+			ok = subreddits.load_spilled(blocks[j], other);
+			find_common_authors_between(block, other, top);
+		}
+	}
+	subreddits.remove_spilled();
+	return ok;
+}
+
+/*
+ * Query server mode. After the data gathering, instead of printing the toplist and
+ * exiting, we keep everything in memory and answer queries read from the standard
+ * input, one per line, so the file does not have to be processed again for every
+ * variation of the question:
+ *   top <k>                       the k pairs with the most common authors
+ *   authors <subreddit>           the number of authors of one subreddit
+ *   pair <subreddit> <subreddit>  the number of common authors of two subreddits
+ *   memory                        the estimated memory used by each index
+ *   quit
+ * The second phase is run before "ready" (with it's progress lines), and the best
+ * SERVE_PAIRS pairs are kept, so a top query is only a lookup. All the pairs can't be
+ * kept, their number is quadratic in the number of subreddits. Every answer is closed
+ * by an "ok" line (or starts with "error"), followed by the time it took to answer.
+ */
+const int SERVE_PAIRS = 10000;
+
+void serve(Subreddits& subreddits, AuthorMap& authors) {
+	TopList top(SERVE_PAIRS);
+	find_common_authors(subreddits, top);
+	cout << "ready" << endl;
+	for (string line; getline(cin, line); ) {
+		istringstream iss(line);
+		string command;
+		iss >> command;
+		if (command.empty()) {
+			continue;
+		}
+		if (command == "quit") {
+			break;
+		}
+		auto start = chrono::steady_clock::now();
+		if (command == "top") {
+			int number = 10;
+			iss >> number;
+			if (number <= 0 || number > SERVE_PAIRS) {
+				cout << "error: k must be between 1 and " << SERVE_PAIRS << endl;
+				continue;
+			}
+			top.print(number);
+		}
+		else if (command == "authors") {
+			string subreddit;
+			iss >> subreddit;
+			if (!subreddits.contains(subreddit)) {
+				cout << "error: unknown subreddit " << subreddit << endl;
+				continue;
+			}
+			cout << subreddit << ": " << subreddits.getNumberOfAuthors(subreddit) << endl;
+		}
+		else if (command == "pair") {
+			string subreddit1, subreddit2;
+			iss >> subreddit1 >> subreddit2;
+			if (!subreddits.contains(subreddit1) || !subreddits.contains(subreddit2)) {
+				cout << "error: unknown subreddit" << endl;
+				continue;
+			}
+			cout << subreddit1 << ", " << subreddit2 << ": " << subreddits.getNumberOfCommon(subreddit1, subreddit2) << endl;
+		}
+		else if (command == "memory") {
+			cout << "authors: " << authors.getNumberOfElements() << " authors, " << authors.memory_usage() << " bytes" << endl;
+			cout << "author sets: " << subreddits.getNumberOfSubreddits() << " subreddits, " << subreddits.set_memory_usage() << " bytes" << endl;
+			cout << "author vectors: " << subreddits.getNumberOfSubreddits() << " subreddits, " << subreddits.vector_memory_usage() << " bytes" << endl;
+		}
+		else {
+			cout << "error: unknown command " << command << endl;
+			continue;
+		}
+		auto elapsed = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start);
+		cout << "ok " << elapsed.count() / 1000.0 << " ms" << endl;
+	}
+}
+
+/*
+ * Approximate mode (--minhash). Instead of the sets of authors, we only keep a MinHash
+ * signature for every subreddit: for each of SIGNATURE_SIZE hash functions, the
+ * smallest hash of all the authors of the subreddit. The probability that two
+ * subreddits have the same minimum for a hash function is their Jaccard similarity
+ * (common authors / all authors), so the fraction of equal minimums estimates it. The
+ * memory used is SIGNATURE_SIZE numbers per subreddit, no matter how many authors.
+ */
+const int SIGNATURE_SIZE = 128;
+/*
+ * LSH: the first BANDS * ROWS rows of the signature are cut into BANDS bands of ROWS
+ * rows, and two subreddits are candidates if they are equal in at least one band. A
+ * pair with Jaccard J is found with probability 1 - (1 - J^ROWS)^BANDS, the threshold
+ * is about (1 / BANDS)^(1 / ROWS). Subreddits with many common authors still have a
+ * low Jaccard (about 0.1 on the real data, as the big ones have many authors of their
+ * own), so the threshold has to be low: one row per band and 20 bands make it 0.05 (a
+ * pair with J = 0.1 is found with a probability of 88%, with J = 0.2 of 99%).
+ */
+const int BANDS = 20;
+const int ROWS = 1;
+
+class MinHashSignatures {
+	mutex mu_write;
+	FlatHashMap<string, vector<unsigned long long>> map;
+public:
+	// thread-safe, the hashes are computed before locking.
+	void shared_insert(string subreddit, string author) {
+		unsigned long long base = hash<string>()(author);
+		unsigned long long hashes[SIGNATURE_SIZE];
+		for (int i = 0; i < SIGNATURE_SIZE; ++i) {
+			hashes[i] = mix(base ^ mix(i));
+		}
+		lock_guard<mutex> locker(mu_write);
+		vector<unsigned long long>& signature = map[subreddit];
+		if (signature.empty()) {
+			signature.assign(SIGNATURE_SIZE, ~0ULL);
+		}
+		for (int i = 0; i < SIGNATURE_SIZE; ++i) {
+			if (hashes[i] < signature[i]) {
+				signature[i] = hashes[i];
+			}
+		}
+	}
+
+	FlatHashMap<string, vector<unsigned long long>>* getSignatures() {
+		return &map;
+	}
+};
+
+// fraction of the hash functions where the two signatures have the same minimum.
+double estimate_jaccard(const vector<unsigned long long>& a, const vector<unsigned long long>& b) {
+	int equal = 0;
+	for (int i = 0; i < SIGNATURE_SIZE; ++i) {
+		if (a[i] == b[i]) {
+			equal++;
+		}
+	}
+	return equal / (double)SIGNATURE_SIZE;
+}
+
+// the expected minimum of n uniform hashes is 1 / (n + 1) of the range, so the
+// average of the minimums gives an estimate of the number of distinct authors.
+double estimate_number_of_authors(const vector<unsigned long long>& signature) {
+	double sum = 0;
+	for (const auto& minimum : signature) {
+		sum += minimum / 18446744073709551616.0;
+	}
+	return SIGNATURE_SIZE / sum - 1;
+}
+
+// |A and B| = J * |A or B|, the union is estimated from it's own signature, which is the
+// smaller of the two minimums for every hash function.
+double estimate_intersection(const vector<unsigned long long>& a, const vector<unsigned long long>& b, double jaccard) {
+	vector<unsigned long long> either(SIGNATURE_SIZE);
+	for (int i = 0; i < SIGNATURE_SIZE; ++i) {
+		either[i] = min(a[i], b[i]);
+	}
+	return jaccard * estimate_number_of_authors(either);
+}
+
+// the data gathering of the approximate mode, no author map and no sets here.
+void do_minhash_work(SharedFileReader& reader, MinHashSignatures& signatures) {
+	for (string line; reader.shared_read(line); ) {
+		auto json_line = json::parse(line.c_str());
+		signatures.shared_insert(json_line["subreddit"], json_line["author"]);
+	}
+}
+
+/*
+ * The second phase of the approximate mode. The candidate pairs come from LSH banding,
+ * and from the biggest subreddits: a low Jaccard still means many common authors if
+ * both subreddits are big, and these pairs are what the top list is about. So the
+ * subreddits are sorted by their estimated number of authors, and their pairs are
+ * compared in this order as long as the smaller one has more authors than the
+ * smallest of the top list (the common authors can't be more than that). Usually
+ * only the pairs of a few hundred subreddits are needed for this. Every candidate is
+ * ranked by it's estimated intersection (see estimate_intersection).
+ *
+ * Subreddits with (nearly) the same few authors, e.g. the ones where only AutoModerator
+ * or [deleted] comments, have the same signature, so they fall into the same bucket in
+ * every band, and comparing every pair of such a bucket is quadratic. A bucket with
+ * more than MAX_BUCKET subreddits is skipped (and reported): it's pairs have only a
+ * few common authors, or they are big and compared anyway. The number of candidate
+ * pairs is also capped at MAX_CANDIDATES, the pairs after that are not compared (and
+ * this is reported too).
+ */
+const size_t MAX_BUCKET = 1000;
+const size_t MAX_CANDIDATES = 10000000;
+
+void find_similar_pairs(MinHashSignatures& signatures, TopList& top) {
+	vector<FlatHashMap<string, vector<unsigned long long>>::iterator> subreddits;
+	for (auto element = signatures.getSignatures()->begin(); element != signatures.getSignatures()->end(); ++element) {
+		subreddits.push_back(element);
+	}
+	unsigned long long n = subreddits.size();
+	// a pair is a candidate once, as the smaller number * n + the bigger one.
+	FlatHashSet<unsigned long long> candidates;
+	auto compare = [&](unsigned long long a, unsigned long long b) {
+		double jaccard = estimate_jaccard(subreddits[a]->second, subreddits[b]->second);
+		top.add(Pair(subreddits[a]->first, subreddits[b]->first, (long)(estimate_intersection(subreddits[a]->second, subreddits[b]->second, jaccard) + 0.5), jaccard));
+	};
+
+	// the pairs of the biggest subreddits.
+	vector<double> sizes(n);
+	vector<unsigned long long> by_size(n);
+	for (unsigned long long i = 0; i < n; ++i) {
+		sizes[i] = estimate_number_of_authors(subreddits[i]->second);
+		by_size[i] = i;
+	}
+	sort(by_size.begin(), by_size.end(), [&sizes](unsigned long long a, unsigned long long b) {
+		return sizes[a] > sizes[b];
+	});
+	long biggest = 0;
+	for (unsigned long long a = 0; a < n && sizes[by_size[a]] > top.getSmallest() && candidates.size() < MAX_CANDIDATES; ++a) {
+		for (unsigned long long b = a + 1; b < n && sizes[by_size[b]] > top.getSmallest() && candidates.size() < MAX_CANDIDATES; ++b) {
+			unsigned long long first = min(by_size[a], by_size[b]), second = max(by_size[a], by_size[b]);
+			candidates.insert(first * n + second);
+			compare(first, second);
+		}
+		biggest = a + 1;
+	}
+
+	long skipped_buckets = 0, skipped_subreddits = 0, skipped_pairs = 0;
+	size_t banded = 0;
+	for (int band = 0; band < BANDS; ++band) {
+		FlatHashMap<unsigned long long, vector<unsigned long long>> buckets;
+		for (unsigned long long i = 0; i < n; ++i) {
+			unsigned long long band_hash = band;
+			for (int row = band * ROWS; row < (band + 1) * ROWS; ++row) {
+				band_hash = mix(band_hash ^ subreddits[i]->second[row]);
+			}
+			buckets[band_hash].push_back(i);
+		}
+		for (auto bucket = buckets.begin(); bucket != buckets.end(); ++bucket) {
+			size_t size = bucket->second.size();
+			if (size > MAX_BUCKET) {
+				skipped_buckets++;
+				skipped_subreddits += size;
+				continue;
+			}
+			for (size_t a = 0; a < size; ++a) {
+				for (size_t b = a + 1; b < size; ++b) {
+					unsigned long long candidate = bucket->second[a] * n + bucket->second[b];
+					if (candidates.count(candidate) != 0) {
+						continue;
+					}
+					if (candidates.size() < MAX_CANDIDATES) {
+						candidates.insert(candidate);
+						compare(bucket->second[a], bucket->second[b]);
+						banded++;
+					}
+					else {
+						skipped_pairs++;
+					}
+				}
+			}
+		}
+	}
+	if (skipped_buckets > 0) {
+		cout << "skipped " << skipped_buckets << " buckets with more than " << MAX_BUCKET << " subreddits (" << skipped_subreddits << " subreddits in all bands)" << endl;
+	}
+	if (skipped_pairs > 0) {
+		cout << "reached " << MAX_CANDIDATES << " candidate pairs, " << skipped_pairs << " more pairs were not compared" << endl;
+	}
+	cout << "Number of candidate pairs: " << candidates.size() << " (of " << n * (n - 1) / 2 << "), " << candidates.size() - banded << " of the " << biggest << " biggest subreddits, " << banded << " more from LSH" << endl;
+}
+
+/*
+ * Exact re-verification of the best candidates of the approximate mode (--verify).
+ * The file is read again, but only the authors of the subreddits in the candidate
+ * pairs are stored, so the memory stays small.
+ */
+class CandidateAuthors {
+	mutex mu_write;
+	FlatHashMap<string, FlatHashSet<string>> map;
+public:
+	// the subreddits have to be added before the threads start.
+	void add_subreddit(string subreddit) {
+		map[subreddit];
+	}
+
+	// thread-safe, ignores every subreddit which is not a candidate.
+	void shared_insert(string subreddit, string author) {
+		auto element = map.find(subreddit);
+		if (element != map.end()) {
+			lock_guard<mutex> locker(mu_write);
+			element->second.insert(author);
+		}
+	}
+
+	long getNumberOfCommon(string subreddit1, string subreddit2) {
+		FlatHashSet<string>* small = &map[subreddit1];
+		FlatHashSet<string>* big = &map[subreddit2];
+		if (small->size() > big->size()) {
+			swap(small, big);
+		}
+		long common_authors = 0;
+		for (const auto& author : *small) {
+			if (big->count(author) != 0) {
+				common_authors++;
+			}
+		}
+		return common_authors;
+	}
+};
+
+void do_verify_work(SharedFileReader& reader, CandidateAuthors& candidates) {
+	for (string line; reader.shared_read(line); ) {
+		auto json_line = json::parse(line.c_str());
+		candidates.shared_insert(json_line["subreddit"], json_line["author"]);
+	}
+}
+
+// reads the file again and replaces the estimates of the candidates with the exact
+// number of common authors.
+void verify_pairs(SharedFileReader& file_reader, TopList& candidates, TopList& top) {
+	CandidateAuthors candidate_authors;
+	for (int i = 0; i < candidates.getSize(); ++i) {
+		if (candidates.get(i).getNumberOfCommon() > 0) {
+			candidate_authors.add_subreddit(candidates.get(i).getSubreddit1());
+			candidate_authors.add_subreddit(candidates.get(i).getSubreddit2());
+		}
+	}
+
+	thread t1(do_verify_work, ref(file_reader), ref(candidate_authors));
+	thread t2(do_verify_work, ref(file_reader), ref(candidate_authors));
+	thread t3(do_verify_work, ref(file_reader), ref(candidate_authors));
+	thread t4(do_verify_work, ref(file_reader), ref(candidate_authors));
+	thread t5(do_verify_work, ref(file_reader), ref(candidate_authors));
+	thread t6(do_verify_work, ref(file_reader), ref(candidate_authors));
+	thread t7(do_verify_work, ref(file_reader), ref(candidate_authors));
+	thread t8(do_verify_work, ref(file_reader), ref(candidate_authors));
+	t1.join();
+	t2.join();
+	t3.join();
+	t4.join();
+	t5.join();
+	t6.join();
+	t7.join();
+	t8.join();
+	cout << "Finished with verifying the candidates..." << endl;
+
+	for (int i = 0; i < candidates.getSize(); ++i) {
+		Pair p = candidates.get(i);
+		if (p.getNumberOfCommon() > 0) {
+			top.add(Pair(p.getSubreddit1(), p.getSubreddit2(), candidate_authors.getNumberOfCommon(p.getSubreddit1(), p.getSubreddit2())));
+		}
+	}
+}
+
+// runs the whole approximate mode and prints the toplist.
+void find_common_authors_approximately(vector<string>& files, vector<FileRange> ranges, LineFilter& filter, bool verify) {
+	MinHashSignatures signatures;
+	{
+		SharedFileReader file_reader(files, ranges, filter);
+		thread t1(do_minhash_work, ref(file_reader), ref(signatures));
+		thread t2(do_minhash_work, ref(file_reader), ref(signatures));
+		thread t3(do_minhash_work, ref(file_reader), ref(signatures));
+		thread t4(do_minhash_work, ref(file_reader), ref(signatures));
+		thread t5(do_minhash_work, ref(file_reader), ref(signatures));
+		thread t6(do_minhash_work, ref(file_reader), ref(signatures));
+		thread t7(do_minhash_work, ref(file_reader), ref(signatures));
+		thread t8(do_minhash_work, ref(file_reader), ref(signatures));
+		t1.join();
+		t2.join();
+		t3.join();
+		t4.join();
+		t5.join();
+		t6.join();
+		t7.join();
+		t8.join();
+		cout << "Finished with first multithreadding..." << endl;
+	}
+
+	if (!verify) {
+		TopList top(10);
+		find_similar_pairs(signatures, top);
+		top.print();
+		return;
+	}
+	// we keep 5 times more candidates than needed, as the estimates are not exact.
+	TopList candidates(50);
+	find_similar_pairs(signatures, candidates);
+	SharedFileReader file_reader(files, ranges, filter);
+	TopList top(10);
+	verify_pairs(file_reader, candidates, top);
+	top.print();
+}
+
+// the number of the sampled lines of an author in the sample (replicate < 0), or
+// weighted by a bootstrap replicate.
+long count_lines(const vector<unsigned long long>& blocks, int replicate) {
+	if (replicate < 0) {
+		return blocks.size();
+	}
+	long count = 0;
+	for (const auto& block : blocks) {
+		count += bootstrap_weight(block, replicate);
+	}
+	return count;
+}
+
+// the number of authors seen at all, seen once and seen twice (sign is -1 to remove one).
+class DistinctCounts {
+public:
+	double seen, once, twice;
+
+	DistinctCounts() {
+		seen = 0;
+		once = 0;
+		twice = 0;
+	}
+
+	void add(long count, int sign) {
+		seen += sign * (count > 0);
+		once += sign * (count == 1);
+		twice += sign * (count == 2);
+	}
+
+	double estimate(double q) {
+		return estimate_distinct(seen, once, twice, q);
+	}
+};
+
+// For the bootstrap we keep the sampled block (see sample_block) of every line of every
+// author of a subreddit.
+typedef FlatHashMap<long, vector<unsigned long long>> SampledAuthors;
+
+DistinctCounts count_authors(SampledAuthors& authors, int replicate) {
+	DistinctCounts counts;
+	for (const auto& author : authors) {
+		counts.add(count_lines(author.second, replicate), 1);
+	}
+	return counts;
+}
+
+// the estimated number of common authors, in the sample or in a replicate: the authors
+// of the first plus the authors of the second minus the authors of the two together
+// (see estimate_distinct).
+double estimate_common(SampledAuthors& authors1, DistinctCounts counts1, SampledAuthors& authors2, DistinctCounts counts2, double q, int replicate) {
+	// we start with the counts of the two, and fix them for the common authors.
+	DistinctCounts together = counts1;
+	together.seen += counts2.seen;
+	together.once += counts2.once;
+	together.twice += counts2.twice;
+	SampledAuthors* small = &authors1;
+	SampledAuthors* big = &authors2;
+	if (small->size() > big->size()) {
+		swap(small, big);
+	}
+	for (const auto& author : *small) {
+		auto other = big->find(author.first);
+		if (other == big->end()) {
+			continue;
+		}
+		long count1 = count_lines(author.second, replicate);
+		long count2 = count_lines(other->second, replicate);
+		if (count1 > 0 && count2 > 0) {
+			together.add(count1, -1);
+			together.add(count2, -1);
+			together.add(count1 + count2, 1);
+		}
+	}
+	return max(0.0, counts1.estimate(q) + counts2.estimate(q) - together.estimate(q));
+}
+
+class SampledSubreddits {
+	mutex mu_write;
+	FlatHashMap<string, SampledAuthors> map;
+public:
+	// thread-safe, adds the author of a sampled line.
+	void shared_insert(string subreddit, long author_id, unsigned long long block) {
+		lock_guard<mutex> locker(mu_write);
+		map[subreddit][author_id].push_back(block);
+	}
+
+	FlatHashMap<string, SampledAuthors>* getSubreddits() {
+		return &map;
+	}
+};
+
+// the data gathering of the sampling mode, the same as do_work, but the authors are
+// stored with the block of the line.
+void do_sample_work(SharedFileReader& reader, SampledSubreddits& sampled, AuthorMap& authors) {
+	int file;
+	long long offset;
+	for (string line; reader.shared_read(line, file, offset); ) {
+		auto json_line = json::parse(line.c_str());
+		string subreddit = json_line["subreddit"];
+		string author = json_line["author"];
+		sampled.shared_insert(subreddit, authors.shared_insert(author), sample_block(file, offset));
+	}
+}
+
+// Every pair is estimated from the sample, but only the best SAMPLE_CANDIDATES pairs
+// are estimated again in the bootstrap replicates (ranks are compared between these).
+const int SAMPLE_CANDIDATES = 30;
+
+/*
+ * Reads the sample with 8 threads, and prints the number pairs with the most common
+ * authors estimated from it. Both the estimates of every pair and the replicates of
+ * the candidates are divided between 8 threads.
+ */
+void find_common_authors_in_sample(vector<string>& files, LineFilter& filter, AuthorMap& authors, double fraction, unsigned long long seed, int number) {
+	double sampled_fraction;
+	SharedFileReader file_reader(files, get_sample_ranges(files, fraction, seed, sampled_fraction), filter);
+	SampledSubreddits sampled;
+
+	thread t1(do_sample_work, ref(file_reader), ref(sampled), ref(authors));
+	thread t2(do_sample_work, ref(file_reader), ref(sampled), ref(authors));
+	thread t3(do_sample_work, ref(file_reader), ref(sampled), ref(authors));
+	thread t4(do_sample_work, ref(file_reader), ref(sampled), ref(authors));
+	thread t5(do_sample_work, ref(file_reader), ref(sampled), ref(authors));
+	thread t6(do_sample_work, ref(file_reader), ref(sampled), ref(authors));
+	thread t7(do_sample_work, ref(file_reader), ref(sampled), ref(authors));
+	thread t8(do_sample_work, ref(file_reader), ref(sampled), ref(authors));
+	t1.join();
+	t2.join();
+	t3.join();
+	t4.join();
+	t5.join();
+	t6.join();
+	t7.join();
+	t8.join();
+	cout << "Finished with first multithreadding..." << endl;
+
+	vector<string> subreddit_names;
+	vector<SampledAuthors*> subreddit_authors;
+	vector<DistinctCounts> subreddit_counts;
+	for (auto element = sampled.getSubreddits()->begin(); element != sampled.getSubreddits()->end(); ++element) {
+		subreddit_names.push_back(element->first);
+		subreddit_authors.push_back(&element->second);
+		subreddit_counts.push_back(count_authors(element->second, -1));
+	}
+	FlatHashMap<string, long> subreddit_numbers;
+	for (size_t i = 0; i < subreddit_names.size(); ++i) {
+		subreddit_numbers[subreddit_names[i]] = i;
+	}
+
+	// The estimated authors of i and j together are at least the seen authors of i, so
+	// their common authors are at most (estimated authors of j) + (estimated - seen
+	// authors of i). The subreddits are compared in the order of their estimated
+	// authors, the most first, so for every i this bound only gets smaller with j, and
+	// once it's not more than the smallest candidate, none of the later j can get on
+	// the list (like the pairs of the exact mode which could not beat the list).
+	size_t n = subreddit_names.size();
+	vector<double> estimated(n), unseen(n);
+	vector<size_t> by_size(n);
+	for (size_t i = 0; i < n; ++i) {
+		estimated[i] = subreddit_counts[i].estimate(sampled_fraction);
+		unseen[i] = estimated[i] - subreddit_counts[i].seen;
+		by_size[i] = i;
+	}
+	sort(by_size.begin(), by_size.end(), [&estimated](size_t a, size_t b) {
+		return estimated[a] > estimated[b];
+	});
+	TopList candidates(SAMPLE_CANDIDATES);
+	atomic<long long> estimated_pairs(0);
+	vector<thread> threads;
+	for (int part = 0; part < 8; ++part) {
+		threads.push_back(thread([&, part]() {
+			for (size_t a = part; a < n; a += 8) {
+				size_t i = by_size[a];
+				for (size_t b = a + 1; b < n && unseen[i] + estimated[by_size[b]] > candidates.getSmallest(); ++b) {
+					size_t j = by_size[b];
+					double common = estimate_common(*subreddit_authors[i], subreddit_counts[i], *subreddit_authors[j], subreddit_counts[j], sampled_fraction, -1);
+					candidates.add(Pair(subreddit_names[i], subreddit_names[j], llround(common)));
+					estimated_pairs++;
+				}
+			}
+		}));
+	}
+	for (auto& t : threads) {
+		t.join();
+	}
+	cout << "Estimated pairs: " << estimated_pairs << " of " << n * (n - 1) / 2 << endl;
+
+	// the candidates as pairs of subreddit numbers (the toplist may not be full).
+	vector<pair<long, long>> pairs;
+	vector<string> names;
+	vector<double> estimates;
+	for (int i = 0; i < candidates.getSize(); ++i) {
+		Pair p = candidates.get(i);
+		if (p.getSubreddit1().empty()) {
+			continue;
+		}
+		long first = subreddit_numbers[p.getSubreddit1()], second = subreddit_numbers[p.getSubreddit2()];
+		pairs.push_back(make_pair(first, second));
+		names.push_back(p.getSubreddit1() + ", " + p.getSubreddit2());
+		estimates.push_back(estimate_common(*subreddit_authors[first], subreddit_counts[first], *subreddit_authors[second], subreddit_counts[second], sampled_fraction, -1));
+	}
+	vector<vector<double>> replicates(REPLICATES, vector<double>(pairs.size(), 0));
+	threads.clear();
+	for (int part = 0; part < 8; ++part) {
+		threads.push_back(thread([&, part]() {
+			for (int replicate = part; replicate < REPLICATES; replicate += 8) {
+				for (size_t i = 0; i < pairs.size(); ++i) {
+					SampledAuthors& authors1 = *subreddit_authors[pairs[i].first];
+					SampledAuthors& authors2 = *subreddit_authors[pairs[i].second];
+					replicates[replicate][i] = estimate_common(authors1, count_authors(authors1, replicate), authors2, count_authors(authors2, replicate), sampled_fraction, replicate);
+				}
+			}
+		}));
+	}
+	for (auto& t : threads) {
+		t.join();
+	}
+	cout << "Estimated from " << 100 * sampled_fraction << "% of the file (seed " << seed << "), with " << REPLICATES << " bootstrap replicates:" << endl;
+	print_sampled_toplist(names, estimates, replicates, sampled_fraction, number);
+}
+
+int main(int argc, char* argv[])
+{
+	// --buckets turns on the time-bucketed mode: top lists for every day and week.
+	// --serve keeps the data in memory and answers queries from the standard input.
+	// --input <path>... reads other files, directories or patterns instead of the default file.
+	// --shard <i>/<n> only reads the i-th of n equal parts of the input.
+	// --map <path> writes the partial result to the file instead of printing the list.
+	// --reduce <path>... merges the partial results instead of reading the input.
+	// --minhash estimates the common authors with MinHash signatures instead of sets.
+	// --verify counts the common authors of the best --minhash candidates exactly.
+	// --neighbours <path> writes the best neighbours of every subreddit to the file.
+	// --sample <fraction> estimates the result from a random part of the file.
+	// --seed <n> draws the blocks of the sample with this seed instead of the default one.
+	// --build-index writes the block index of the input files (see build_index).
+	// --subreddit <name>... only reads the comments of the given subreddits.
+	// --since <date> and --until <date> only read the comments of these days.
+	// --dictionary <path> loads the authors frozen by an earlier run (see FrozenDictionary).
+	// --freeze-dictionary <path> writes the authors as a frozen dictionary for later runs.
+	// --memory-limit <Mb> spills the largest partitions to the disk above the limit.
+	// --spill <directory> writes the partitions of --memory-limit there.
+	// --progress <seconds> prints the estimated top list at every interval while reading
+	// (only the pairs of the 30 largest subreddits so far, from sketches of 64 authors).
+	bool bucketed = false;
+	bool minhash = false;
+	bool verify = false;
+	double sample_fraction = 0;
+	unsigned long long seed = DEFAULT_SEED;
+	bool seeded = false;
+	long long memory_limit = 0;
+	string spill_directory = ".";
+	int progress_interval = 0;
+	bool server = false;
+	bool building_index = false;
+	string dictionary_path, freeze_path;
+	LineFilter filter;
+	long long since = LLONG_MIN, until = LLONG_MAX;
+	vector<string> inputs;
+	int shard = 0, shards = 1;
+	string map_path;
+	string neighbours_path;
+	vector<string> partial_paths;
+	for (int i = 1; i < argc; ++i) {
+		if (string(argv[i]) == "--buckets") {
+			bucketed = true;
+		}
+		else if (string(argv[i]) == "--serve") {
+			server = true;
+		}
+		else if (string(argv[i]) == "--input") {
+			while (i + 1 < argc && string(argv[i + 1]).compare(0, 2, "--") != 0) {
+				inputs.push_back(argv[++i]);
+			}
+		}
+		else if (string(argv[i]) == "--shard" && i + 1 < argc) {
+			if (sscanf(argv[++i], "%d/%d", &shard, &shards) != 2 || shard < 0 || shard >= shards) {
+				cout << "error: --shard expects <i>/<n> with 0 <= i < n" << endl;
+				return 1;
+			}
+		}
+		else if (string(argv[i]) == "--map" && i + 1 < argc) {
+			map_path = argv[++i];
+		}
+		else if (string(argv[i]) == "--reduce") {
+			while (i + 1 < argc && string(argv[i + 1]).compare(0, 2, "--") != 0) {
+				partial_paths.push_back(argv[++i]);
+			}
+		}
+		else if (string(argv[i]) == "--minhash") {
+			minhash = true;
+		}
+		else if (string(argv[i]) == "--verify") {
+			verify = true;
+		}
+		else if (string(argv[i]) == "--neighbours" && i + 1 < argc) {
+			neighbours_path = argv[++i];
+		}
+		else if (string(argv[i]) == "--sample" && i + 1 < argc) {
+			sample_fraction = atof(argv[++i]);
+			if (!(sample_fraction > 0 && sample_fraction <= 1)) {
+				cout << "error: --sample expects a fraction between 0 and 1" << endl;
+				return 1;
+			}
+		}
+		else if (string(argv[i]) == "--seed" && i + 1 < argc) {
+			seed = strtoull(argv[++i], nullptr, 10);
+			seeded = true;
+		}
+		else if (string(argv[i]) == "--memory-limit" && i + 1 < argc) {
+			memory_limit = atoll(argv[++i]);
+			if (memory_limit <= 0) {
+				cout << "error: --memory-limit expects a positive number of Mb" << endl;
+				return 1;
+			}
+		}
+		else if (string(argv[i]) == "--spill" && i + 1 < argc) {
+			spill_directory = argv[++i];
+		}
+		else if (string(argv[i]) == "--progress" && i + 1 < argc) {
+			progress_interval = atoi(argv[++i]);
+			if (progress_interval <= 0) {
+				cout << "error: --progress expects a positive number of seconds" << endl;
+				return 1;
+			}
+		}
+		else if (string(argv[i]) == "--dictionary" && i + 1 < argc) {
+			dictionary_path = argv[++i];
+		}
+		else if (string(argv[i]) == "--freeze-dictionary" && i + 1 < argc) {
+			freeze_path = argv[++i];
+		}
+		else if (string(argv[i]) == "--build-index") {
+			building_index = true;
+		}
+		else if (string(argv[i]) == "--subreddit") {
+			while (i + 1 < argc && string(argv[i + 1]).compare(0, 2, "--") != 0) {
+				filter.add_subreddit(argv[++i]);
+			}
+		}
+		else if ((string(argv[i]) == "--since" || string(argv[i]) == "--until") && i + 1 < argc) {
+			bool is_until = string(argv[i]) == "--until";
+			if (!parse_date(argv[++i], is_until, is_until ? until : since)) {
+				cout << "error: " << argv[i - 1] << " expects a date (YYYY-MM-DD) or a unix timestamp" << endl;
+				return 1;
+			}
+		}
+		else {
+			cout << "error: unknown option " << argv[i] << " (or it's value is missing)" << endl;
+			return 1;
+		}
+	}
+	filter.set_time_range(since, until);
+	// the reducer does not read the input, so there is nothing to filter or index.
+	if (!partial_paths.empty() && (building_index || filter.is_active())) {
+		cout << "error: --build-index, --subreddit, --since and --until can not be used with --reduce" << endl;
+		return 1;
+	}
+	// the partial results do not have days in them.
+	if (bucketed && (!map_path.empty() || !partial_paths.empty())) {
+		cout << "error: --buckets can not be used with --map or --reduce" << endl;
+		return 1;
+	}
+	// the approximate mode has no sets (and no author map), so it can only print the list.
+	if (minhash && (bucketed || server || !map_path.empty() || !partial_paths.empty() || !dictionary_path.empty() || !freeze_path.empty())) {
+		cout << "error: --minhash can not be used with --buckets, --serve, --map, --reduce, --dictionary or --freeze-dictionary" << endl;
+		return 1;
+	}
+	// the neighbour lists are filled by the second phase of a normal run.
+	if (!neighbours_path.empty() && (minhash || server || !map_path.empty())) {
+		cout << "error: --neighbours can not be used with --minhash, --serve or --map" << endl;
+		return 1;
+	}
+	if (seeded && sample_fraction == 0) {
+		cout << "error: --seed can only be used with --sample" << endl;
+		return 1;
+	}
+	// the sample is only good for a quick preview of the list (and it does not see
+	// every author, so there is nothing to freeze).
+	if (sample_fraction > 0 && (bucketed || minhash || server || shards != 1 || !map_path.empty() || !partial_paths.empty() || !neighbours_path.empty() || !freeze_path.empty())) {
+		cout << "error: --sample can not be used with --buckets, --minhash, --serve, --shard, --map, --reduce, --neighbours or --freeze-dictionary" << endl;
+		return 1;
+	}
+	// the spilled partitions are only read back by the second phase of the list (and
+	// the neighbour lists need every subreddit at the same time).
+	if (memory_limit > 0 && (bucketed || minhash || server || sample_fraction > 0 || !map_path.empty() || !neighbours_path.empty())) {
+		cout << "error: --memory-limit can not be used with --buckets, --minhash, --serve, --sample, --map or --neighbours" << endl;
+		return 1;
+	}
+	// the running top list needs the authors of the whole input in memory (the days have
+	// their own sets, and a spilled subreddit would start again from 0).
+	if (progress_interval > 0 && (bucketed || minhash || sample_fraction > 0 || memory_limit > 0)) {
+		cout << "error: --progress can not be used with --buckets, --minhash, --sample or --memory-limit" << endl;
+		return 1;
+	}
+	// the list of the input files, the default file if there was no --input (the
+	// reducer does not read the input).
+	if (inputs.empty()) {
+		inputs.push_back("C:\\reddit\\reddit");
+	}
+	vector<string> files;
+	for (size_t i = 0; i < inputs.size() && partial_paths.empty(); ++i) {
+		if (!expand_input(inputs[i], files)) {
+			cout << "error: could not open " << inputs[i] << endl;
+			return 1;
+		}
+	}
+	if (files.empty() && partial_paths.empty()) {
+		cout << "error: no input files" << endl;
+		return 1;
+	}
+	if (building_index) {
+		return build_index(files) ? 0 : 1;
+	}
+	// the author map is created here, as the sample needs it too.
+	AuthorMap authors;
+	if (!dictionary_path.empty() && !authors.load_frozen(dictionary_path)) {
+		cout << "error: could not load the dictionary " << dictionary_path << endl;
+		return 1;
+	}
+	if (sample_fraction > 0) {
+		find_common_authors_in_sample(files, filter, authors, sample_fraction, seed, 10);
+		cin.get();
+		return 0;
+	}
+	if (minhash) {
+		find_common_authors_approximately(files, get_file_ranges(files, shard, shards), filter, verify);
+		cin.get();
+		return 0;
+	}
+
+	// create assets and add their references to the threads. 
+	Subreddits subreddits;
+	if (memory_limit > 0) {
+		subreddits.set_memory_limit(memory_limit << 20, spill_directory);
+	}
+	// daily author sets, only used in bucketed mode.
+	BucketedSubreddits buckets;
+	BucketedSubreddits* buckets_ptr = bucketed ? &buckets : nullptr;
+	// the running top list and it's printer, only used in progressive mode.
+	ProgressiveCommonAuthors progress;
+	thread printer;
+	if (progress_interval > 0) {
+		subreddits.set_progress(&progress);
+	}
+	if (!partial_paths.empty()) {
+		// reducer: one thread for every partial result, they merge into the same maps.
+		vector<thread> reducers;
+		deque<bool> results(partial_paths.size(), false);
+		if (progress_interval > 0) {
+			printer = thread(do_progress_work, ref(progress), progress_interval, 10);
+		}
+		for (size_t i = 0; i < partial_paths.size(); ++i) {
+			reducers.push_back(thread(do_reduce_work, partial_paths[i], ref(subreddits), ref(authors), ref(results[i])));
+		}
+		for (size_t i = 0; i < reducers.size(); ++i) {
+			reducers[i].join();
+			if (!results[i]) {
+				cout << "error: could not read partial result " << partial_paths[i] << endl;
+				return 1;
+			}
+		}
+		cout << "Finished with merging the partial results..." << endl;
+	}
+	else {
+		SharedFileReader file_reader(files, get_file_ranges(files, shard, shards), filter);
+		if (!file_reader.is_open()) {
+			cout << "error: could not open the input files" << endl;
+			return 1;
+		}
+		if (progress_interval > 0) {
+			printer = thread(do_progress_work, ref(progress), progress_interval, 10);
+		}
+		// first part, only gathering the data
+		thread t1(do_work, ref(file_reader), ref(subreddits), ref(authors), buckets_ptr);
+		thread t2(do_work, ref(file_reader), ref(subreddits), ref(authors), buckets_ptr);
+		thread t3(do_work, ref(file_reader), ref(subreddits), ref(authors), buckets_ptr);
+		thread t4(do_work, ref(file_reader), ref(subreddits), ref(authors), buckets_ptr);
+		thread t5(do_work, ref(file_reader), ref(subreddits), ref(authors), buckets_ptr);
+		thread t6(do_work, ref(file_reader), ref(subreddits), ref(authors), buckets_ptr);
+		thread t7(do_work, ref(file_reader), ref(subreddits), ref(authors), buckets_ptr);
+		thread t8(do_work, ref(file_reader), ref(subreddits), ref(authors), buckets_ptr);
+		// waiting for each thread to finish.
+		t1.join();
+		t2.join();
+		t3.join();
+		t4.join();
+		t5.join();
+		t6.join();
+		t7.join();
+		t8.join();
+		cout << "Finished with first multithreadding..." << endl;
+	}
+	if (progress_interval > 0) {
+		progress.finish();
+		printer.join();
+	}
+	if (!subreddits.spill_ok()) {
+		cout << "error: could not write the spilled partitions to " << spill_directory << endl;
+		return 1;
+	}
+
+	// every author has been seen now, so the dictionary can be frozen for the next runs.
+	if (!freeze_path.empty() && !authors.freeze(freeze_path)) {
+		cout << "error: could not write the dictionary " << freeze_path << endl;
+		return 1;
+	}
+
+	// a mapper only writes it's partial result, the reducer will do the second phase.
+	if (!map_path.empty()) {
+		if (!write_partial(map_path, subreddits, authors)) {
+			cout << "error: could not write partial result " << map_path << endl;
+			return 1;
+		}
+		return 0;
+	}
+
+	// in bucketed mode every day and every week gets it's own top list, and the data
+	// of the whole file is built from the days.
+	if (bucketed) {
+		for (auto day = buckets.getDays()->begin(); day != buckets.getDays()->end(); ++day) {
+			TopList day_top(10);
+			find_common_authors(day->second, day_top);
+			cout << "--- day " << day_label(day->first) << " ---" << endl;
+			day_top.print();
+		}
+		buckets.merge_weeks(subreddits, [](long week, Subreddits& week_subreddits) {
+			TopList week_top(10);
+			find_common_authors(week_subreddits, week_top);
+			cout << "--- week starting " << day_label(week * 7 - 3) << " ---" << endl;
+			week_top.print();
+		});
+		cout << "--- whole file ---" << endl;
+	}
+
+	// in server mode the queries decide what gets computed and printed.
+	if (server) {
+		serve(subreddits, authors);
+		return 0;
+	}
+
+	TopList top(10);
+	if (!neighbours_path.empty()) {
+		NeighbourLists neighbours(NEIGHBOURS, subreddits);
+		find_common_authors(subreddits, top, &neighbours);
+		if (!neighbours.write(neighbours_path, subreddits)) {
+			cout << "error: could not write the neighbour lists to " << neighbours_path << endl;
+			return 1;
+		}
+	}
+	else if (subreddits.has_spilled()) {
+		if (!find_common_authors_spilled(subreddits, top)) {
+			cout << "error: could not read the spilled partitions from " << spill_directory << endl;
+			return 1;
+		}
+	}
+	else {
+		find_common_authors(subreddits, top);
+	}
 
 	// print out results. 
 	top.print();
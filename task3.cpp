@@ -3,19 +3,51 @@
 
 #include "stdafx.h"
 #include "json.hpp"
-#include <unordered_map>
-#include <unordered_set>
+#include "flat_hash.h"
+#include "binary_io.h"
+#include "input_reader.h"
+#include "sampling.h"
+#include "ranking_snapshots.h"
 #include <fstream>
 #include <iostream>
 #include <string>
 #include <regex>
 #include <mutex>
 #include <thread>
+#include <map>
+#include <ctime>
+#include <chrono>
+#include <cstdio>
+#include <deque>
+#include <functional>
+#include <algorithm>
+#include <random>
+#include <numeric>
+#include <cmath>
+#include <atomic>
+#include <climits>
 
 
 using namespace std;
 using json = nlohmann::json;
 
+// The memory used by the containers, for the memory report of the query server.
+// memory_of returns the bytes a container (or string) allocates, not counting the
+// object itself, which is either on the stack or already counted as part of the slots
+// of the table holding it. Strings only allocate when they don't fit in the small
+// string buffer.
+size_t memory_of(const string& s) {
+	return s.capacity() > 15 ? s.capacity() + 1 : 0;
+}
+
+size_t memory_of(const FlatHashSet<string>& set) {
+	size_t bytes = set.memory_usage();
+	for (const auto& element : set) {
+		bytes += memory_of(element);
+	}
+	return bytes;
+}
+
 // Container class to store a comment's id and its parent's id.
 class Node {
 	string id;
@@ -31,11 +63,11 @@ public:
 		parent_id = parent_id_in;
 	}
 
-	string get_id() {
+	const string& get_id() const {
 		return id;
 	}
 
-	string get_parent_id() {
+	const string& get_parent_id() const {
 		return parent_id;
 	}
 };
@@ -109,21 +141,104 @@ public:
 	}
 };
 
+// Progressive mode (--progress <seconds>): the current top list is printed at every
+// interval while the file is still being read, so a long run can be stopped once the
+// ranking settles. The depths are only known after the second phase, so the normal
+// mode ranks the subreddits by the number of other comments per thread starter (the
+// estimate of the sample), and the streaming mode by the average of the comments
+// resolved so far. These averages can go down as well, so the running list is only a
+// best estimate: a subreddit on it is updated at every comment, and one which is not
+// on it gets on it at it's next comment if it's better than the worst one. It gets to
+// the printer through the double buffer of RankingSnapshots.
+class ProgressiveTopList {
+	int size;
+	vector<Pair> ranking;
+	size_t smallest_index;
+	RankingSnapshots<Pair> snapshots;
+public:
+	ProgressiveTopList(int s) {
+		size = s;
+		smallest_index = 0;
+	}
+
+	// not thread-safe, called by the subreddits under their lock.
+	void update(const string& subreddit, double value) {
+		size_t i = 0;
+		while (i < ranking.size() && ranking[i].getSubreddit() != subreddit) {
+			i++;
+		}
+		if (i == ranking.size() && (int)ranking.size() < size) {
+			ranking.push_back(Pair());
+		}
+		else if (i == ranking.size()) {
+			i = value > ranking[smallest_index].getValue() ? smallest_index : ranking.size();
+		}
+		if (i < ranking.size()) {
+			ranking[i] = Pair(subreddit, value);
+			smallest_index = 0;
+			for (size_t j = 1; j < ranking.size(); ++j) {
+				if (ranking[j].getValue() < ranking[smallest_index].getValue()) {
+					smallest_index = j;
+				}
+			}
+		}
+		if (snapshots.is_requested()) {
+			snapshots.publish(ranking);
+		}
+	}
+
+	// called after the workers are joined, the printer prints the final list last.
+	void finish() {
+		snapshots.finish(ranking);
+	}
+
+	RankingSnapshots<Pair>* get_snapshots() {
+		return &snapshots;
+	}
+};
+
+// the printer thread of the progressive mode, until the snapshots are finished.
+void do_progress_work(ProgressiveTopList& progress, int interval, int number) {
+	auto start = chrono::steady_clock::now();
+	auto print_snapshot = [&](const vector<Pair>* snapshot, const string& note) {
+		TopList top(number);
+		for (auto pair : *snapshot) {
+			top.add(pair);
+		}
+		cout << "--- after " << chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start).count() / 1000.0 << " s (" << note << ") ---" << endl;
+		top.print();
+	};
+	while (progress.get_snapshots()->wait(chrono::seconds(interval))) {
+		const vector<Pair>* snapshot = progress.get_snapshots()->take(chrono::seconds(interval));
+		if (snapshot != nullptr) {
+			print_snapshot(snapshot, "estimates");
+		}
+	}
+	const vector<Pair>* snapshot = progress.get_snapshots()->get_final();
+	if (snapshot != nullptr) {
+		print_snapshot(snapshot, "final estimates");
+	}
+}
+
 // Contaner class to store nodes (comments) for a subreddit.
 class SubredditMetaData {
 	// first level for each comment's id, where we already know who the parent is. 
-	unordered_set<string> first_level;
+	FlatHashSet<string> first_level;
 	// other level for each other comment. We don't know yet who their parent is.
 	vector<Node> other_level;
 	// levels contains a list if integers to store how much thread with a certain depth
 	// there are. 
 	vector<int> levels;
+	// only used in bucketed mode: the day of the thread starter comment for every
+	// comment in first_level, and the levels separately for every day. 
+	FlatHashMap<string, long> buckets;
+	map<long, vector<int>> bucket_levels;
 public:
 	SubredditMetaData() {
 		
 	}
 
-	SubredditMetaData(unordered_set<string> f_level_in, vector<Node> o_level_in) {
+	SubredditMetaData(FlatHashSet<string> f_level_in, vector<Node> o_level_in) {
 		first_level = f_level_in;
 		other_level = o_level_in;
 	}
@@ -136,7 +251,7 @@ public:
 		levels.push_back(number_of_comments);
 	}
 
-	void set_first_level(unordered_set<string> level_in) {
+	void set_first_level(FlatHashSet<string> level_in) {
 		first_level = level_in;
 	}
 
@@ -148,44 +263,255 @@ public:
 		first_level.insert(id);
 	}
 
+	void add_first_level(string id, long bucket) {
+		first_level.insert(id);
+		buckets[id] = bucket;
+	}
+
+	FlatHashMap<string, long>* get_buckets() {
+		return &buckets;
+	}
+
+	void set_buckets(FlatHashMap<string, long> buckets_in) {
+		buckets = buckets_in;
+	}
+
+	map<long, vector<int>>* get_bucket_levels() {
+		return &bucket_levels;
+	}
+
+	// same as add_level, but only for the threads started on the given day. 
+	void add_bucket_level(long bucket, int level, int number_of_comments) {
+		vector<int>& b_levels = bucket_levels[bucket];
+		if (b_levels.size() <= (size_t)level) {
+			b_levels.resize(level + 1, 0);
+		}
+		b_levels[level] += number_of_comments;
+	}
+
 	void add_other_level(Node n) {
 		other_level.push_back(n);
 	}
 
-	unordered_set<string>* get_first_level() {
+	FlatHashSet<string>* get_first_level() {
 		return &first_level;
 	}
 
 	vector<Node>* get_other_level() {
 		return &other_level;
 	}
+
+	// number of bytes allocated for the comments (see memory_of).
+	size_t memory_usage() {
+		size_t bytes = memory_of(first_level) + other_level.capacity() * sizeof(Node);
+		for (auto& node : other_level) {
+			bytes += memory_of(node.get_id()) + memory_of(node.get_parent_id());
+		}
+		return bytes + levels.capacity() * sizeof(int);
+	}
 };
 
+// Memory limit (--memory-limit): the subreddits are divided into SPILL_PARTITIONS
+// partitions by the hash of their name. When the comments would use more memory than
+// the limit, the largest partitions are written to the spill directory and removed
+// from the memory. The depths of a subreddit only depend on it's own comments, so in
+// the second phase the spilled partitions are read back and resolved one at a time
+// (see find_deepest_spilled), and the result is the same as without the limit.
+const int SPILL_PARTITIONS = 64;
+
+int partition_of(const string& subreddit) {
+	return flat_hash_bytes(subreddit.data(), subreddit.size()) % SPILL_PARTITIONS;
+}
+
 // Subreddits is a class to store all subreddit's data in a map for quick lookup
 // it also provides a function to add a new comment to the existing pool. The data
 // is stored in a map. The key is the name of the subreddit, and the value is a 
 // SubredditMetaData object.
 class Subreddits {
 	mutex mu_write;
-	unordered_map<string, SubredditMetaData> map;
+	FlatHashMap<string, SubredditMetaData> map;
+	// the memory limit in bytes (0 if there is none), and the bytes used by the comments
+	// of every partition which are still in memory (see spill_partition).
+	size_t memory_limit;
+	size_t used;
+	vector<size_t> partition_bytes;
+	vector<bool> spilled;
+	string spill_directory;
+	bool spill_failed;
+	// the running top list of the progressive mode, null if it's off.
+	ProgressiveTopList* progress;
+
+	// the bytes of one subreddit without the ids that don't fit into the small string
+	// buffer (they are added one by one, so we don't have to go through the set).
+	size_t entry_bytes(const string& subreddit, SubredditMetaData& metadata) {
+		return sizeof(string) + sizeof(SubredditMetaData) + memory_of(subreddit) + metadata.get_first_level()->memory_usage() + metadata.get_other_level()->capacity() * sizeof(Node);
+	}
+
+	string spill_path(int partition) {
+		return spill_file_path(spill_directory, "task3", "partition-" + to_string(partition) + ".spill");
+	}
+
+	// Adds the growth of a subreddit's comments to it's partition. If the subreddits use
+	// more than the limit now, the largest partitions are spilled until they use less than
+	// 3/4 of it, so we don't spill again right after the next few comments.
+	void account(const string& subreddit, size_t before, size_t after) {
+		if (memory_limit == 0) {
+			return;
+		}
+		partition_bytes[partition_of(subreddit)] += after - before;
+		used += after - before;
+		if (used <= memory_limit) {
+			return;
+		}
+		while (used > memory_limit / 4 * 3) {
+			int largest = max_element(partition_bytes.begin(), partition_bytes.end()) - partition_bytes.begin();
+			if (partition_bytes[largest] == 0) {
+				break;
+			}
+			spill_partition(largest);
+		}
+	}
+
+	// Appends every subreddit of the partition to it's spill file (a run: the number of
+	// subreddits, then the subreddits sorted by name, each with it's thread starter ids
+	// and it's (id, parent_id) pairs, like in the partial results), and removes them from
+	// the memory. The subreddits of a spilled partition can come again later, they are
+	// collected in memory again, and they may be spilled again as an other run.
+	void spill_partition(int partition) {
+		vector<string> names;
+		for (auto element = map.begin(); element != map.end(); ++element) {
+			if (partition_of(element->first) == partition) {
+				names.push_back(element->first);
+			}
+		}
+		sort(names.begin(), names.end());
+		ofstream out(spill_path(partition), ios::binary | (!spilled[partition] ? ios::trunc : ios::app));
+		write_varint(out, names.size());
+		for (const auto& name : names) {
+			SubredditMetaData& metadata = map[name];
+			write_string(out, name);
+			write_varint(out, metadata.get_first_level()->size());
+			for (const auto& id : *metadata.get_first_level()) {
+				write_string(out, id);
+			}
+			write_varint(out, metadata.get_other_level()->size());
+			for (auto& node : *metadata.get_other_level()) {
+				write_string(out, node.get_id());
+				write_string(out, node.get_parent_id());
+			}
+			map.erase(name);
+		}
+		spill_failed = spill_failed || !out.good();
+		cout << "spilled partition " << partition << ": " << names.size() << " subreddits, " << partition_bytes[partition] / (1 << 20) << " Mb" << endl;
+		used -= partition_bytes[partition];
+		partition_bytes[partition] = 0;
+		spilled[partition] = true;
+	}
 public:
+	Subreddits() {
+		memory_limit = 0;
+		used = 0;
+		spill_failed = false;
+		progress = nullptr;
+	}
+
+	// turns on the progressive mode, has to be called before the first insert.
+	void set_progress(ProgressiveTopList* progress_in) {
+		progress = progress_in;
+	}
+
+	// Limits the memory used by the comments (--memory-limit). Over the limit the largest
+	// partitions are written to the directory. Has to be called before the first insert.
+	void set_memory_limit(size_t limit, string directory) {
+		memory_limit = limit;
+		spill_directory = directory;
+		partition_bytes.assign(SPILL_PARTITIONS, 0);
+		spilled.assign(SPILL_PARTITIONS, false);
+	}
+
+	// false if a spill file could not be written.
+	bool spill_ok() {
+		return !spill_failed;
+	}
+
+	bool is_spilled(int partition) {
+		return memory_limit != 0 && spilled[partition];
+	}
+
+	// Reads back every run of a spilled partition into an other (empty) Subreddits, and
+	// moves the comments of the partition which are still in memory there too. The spill
+	// file is removed after this. Not thread-safe, only used in the second phase.
+	bool load_spilled(int partition, Subreddits& block) {
+		ifstream in(spill_path(partition), ios::binary);
+		while (in.good() && in.peek() != EOF) {
+			unsigned long long number_of_subreddits = read_length(in);
+			for (unsigned long long i = 0; i < number_of_subreddits && in.good(); ++i) {
+				string subreddit = read_string(in);
+				unsigned long long number_of_first_level = read_length(in);
+				for (unsigned long long j = 0; j < number_of_first_level && in.good(); ++j) {
+					block.shared_insert(subreddit, read_string(in), "", true, -1);
+				}
+				unsigned long long number_of_other_level = read_length(in);
+				for (unsigned long long j = 0; j < number_of_other_level && in.good(); ++j) {
+					string id = read_string(in);
+					string parent_id = read_string(in);
+					block.shared_insert(subreddit, id, parent_id, false, -1);
+				}
+			}
+		}
+		bool ok = !in.fail();
+		in.close();
+		remove(spill_path(partition).c_str());
+		vector<string> names;
+		for (auto element = map.begin(); element != map.end(); ++element) {
+			if (partition_of(element->first) == partition) {
+				names.push_back(element->first);
+			}
+		}
+		for (const auto& name : names) {
+			SubredditMetaData& metadata = map[name];
+			for (const auto& id : *metadata.get_first_level()) {
+				block.shared_insert(name, id, "", true, -1);
+			}
+			for (auto& node : *metadata.get_other_level()) {
+				block.shared_insert(name, node.get_id(), node.get_parent_id(), false, -1);
+			}
+			map.erase(name);
+		}
+		return ok;
+	}
 
 	// thread-safe way of adding a new comment to the already existing pool. It needs the name
 	// of the subreddit, the id of the comment, the parent_id of the comment and a boolean to
 	// indicate whether it's a thread starter comment or not (this can be decided by only looking
-	// at the metadata of the comment)
-	void shared_insert(string subreddit, string id, string parent_id, bool isFirstLevel) {
+	// at the metadata of the comment). The day is only used in bucketed mode, otherwise it is -1.
+	void shared_insert(string subreddit, string id, string parent_id, bool isFirstLevel, long day) {
 		lock_guard<mutex> locker(mu_write);
+		size_t before = 0;
 		if (map.count(subreddit) == 0) {
 			SubredditMetaData tmp;
 			map[subreddit] = tmp;
 		}
+		else if (memory_limit != 0) {
+			before = entry_bytes(subreddit, map[subreddit]);
+		}
 		if (isFirstLevel) {
-			map[subreddit].add_first_level(id);
+			if (day >= 0) {
+				map[subreddit].add_first_level(id, day);
+			}
+			else {
+				map[subreddit].add_first_level(id);
+			}
 		}
 		else {
 			map[subreddit].add_other_level(Node(id, parent_id));
 		}
+		if (progress != nullptr && !map[subreddit].get_first_level()->empty()) {
+			progress->update(subreddit, map[subreddit].get_other_level()->size() / (double)map[subreddit].get_first_level()->size());
+		}
+		if (memory_limit != 0) {
+			account(subreddit, before, entry_bytes(subreddit, map[subreddit]) + memory_of(id) + (isFirstLevel ? 0 : memory_of(parent_id)));
+		}
 	}
 
 	void print() {
@@ -198,42 +524,148 @@ public:
 		return &map[subreddit];
 	}
 
-	unordered_map<string, SubredditMetaData>* getMap() {
+	FlatHashMap<string, SubredditMetaData>* getMap() {
 		return &map;
 	}
+
+	bool contains(string subreddit) {
+		return map.count(subreddit) != 0;
+	}
+
+	// number of bytes used by all the comment forests (see memory_of).
+	size_t memory_usage() {
+		size_t bytes = sizeof(map) + map.memory_usage();
+		for (auto element = map.begin(); element != map.end(); ++element) {
+			bytes += memory_of(element->first) + element->second.memory_usage();
+		}
+		return bytes;
+	}
 };
 
-// SharedFileReader provides a thread-safe way of reading lines from the same file
-// without data collision.
-class SharedFileReader {
-	mutex mu_read, mu_write;
-	ifstream input;
-public:
-	SharedFileReader() {
-		input = ifstream("E:\\reddit\\reddit");
+// Helpers for the time-bucketed mode. A bucket is just the number of days (or weeks)
+// elapsed since 1970-01-01, computed from the created_utc field of the comment. Weeks
+// start on monday (1970-01-01 was a thursday, hence the +3).
+long get_created_utc(json& json_line) {
+	// older dumps store the timestamp as a string, newer ones as a number...
+	if (json_line["created_utc"].is_string()) {
+		return stol(json_line["created_utc"].get<string>());
 	}
+	return json_line["created_utc"].get<long>();
+}
 
-	// can only be executed by one thread at a time, returns the next line of the file.
-	basic_istream<char>& shared_read(string& line) {
-		lock_guard<mutex> locker(mu_read);
-		return getline(input, line);
+long day_of(long created_utc) {
+	return created_utc / 86400;
+}
+
+long week_of_day(long day) {
+	return (day + 3) / 7;
+}
+
+// prints a day bucket as YYYY-MM-DD, so the output is readable.
+string day_label(long day) {
+	time_t t = day * 86400;
+	char buffer[16];
+	strftime(buffer, sizeof(buffer), "%Y-%m-%d", gmtime(&t));
+	return string(buffer);
+}
+
+// BucketedLevels collects the levels of every subreddit for every day (a thread
+// belongs to the day it was started). Levels are just counters, so the levels of a
+// week are the sum of the levels of it's days, no need to read the file again.
+class BucketedLevels {
+	mutex mu_write;
+	map<long, FlatHashMap<string, vector<int>>> days;
+public:
+	// thread-safe, adds the daily levels of a subreddit after it's been processed. 
+	void shared_add(string subreddit, map<long, vector<int>>* bucket_levels) {
+		lock_guard<mutex> locker(mu_write);
+		for (auto bucket = bucket_levels->begin(); bucket != bucket_levels->end(); ++bucket) {
+			add_levels(days[bucket->first][subreddit], bucket->second);
+		}
 	}
 
-	// thread-safe print function for debugging purposes.
-	void shared_print(string line) {
-		lock_guard<mutex> locker2(mu_write);
-		cout << line << endl;
+	static void add_levels(vector<int>& to, const vector<int>& from) {
+		if (to.size() < from.size()) {
+			to.resize(from.size(), 0);
+		}
+		for (size_t i = 0; i < from.size(); ++i) {
+			to[i] += from[i];
+		}
 	}
 
+	// merges the days into weeks.
+	void build_weeks(map<long, FlatHashMap<string, vector<int>>>& weeks) {
+		for (auto day = days.begin(); day != days.end(); ++day) {
+			auto& week = weeks[week_of_day(day->first)];
+			for (auto subreddit = day->second.begin(); subreddit != day->second.end(); ++subreddit) {
+				add_levels(week[subreddit->first], subreddit->second);
+			}
+		}
+	}
 
+	map<long, FlatHashMap<string, vector<int>>>* getDays() {
+		return &days;
+	}
 };
+const string PARTIAL_MAGIC = "bigdata-challenge-2 task3 partial v1";
+
+// A partial result contains every subreddit's comments: the ids of the thread starter
+// comments, and the (id, parent_id) pairs of the other comments. The reducer puts them
+// together, and only then can the parents be found, as they might be in an other part.
+bool write_partial(string path, Subreddits& subreddits) {
+	ofstream out(path, ios::binary);
+	write_string(out, PARTIAL_MAGIC);
+	write_varint(out, subreddits.getMap()->size());
+	for (auto element = subreddits.getMap()->begin(); element != subreddits.getMap()->end(); ++element) {
+		write_string(out, element->first);
+		write_varint(out, element->second.get_first_level()->size());
+		for (const auto& id : *element->second.get_first_level()) {
+			write_string(out, id);
+		}
+		write_varint(out, element->second.get_other_level()->size());
+		for (auto& node : *element->second.get_other_level()) {
+			write_string(out, node.get_id());
+			write_string(out, node.get_parent_id());
+		}
+	}
+	return out.good();
+}
+
+// Reads a partial result and adds every comment in it to the subreddits. Thread-safe,
+// so several partials can be read at the same time.
+bool read_partial(string path, Subreddits& subreddits) {
+	ifstream in(path, ios::binary);
+	if (read_string(in) != PARTIAL_MAGIC) {
+		return false;
+	}
+	unsigned long long number_of_subreddits = read_length(in);
+	for (unsigned long long i = 0; i < number_of_subreddits && in.good(); ++i) {
+		string subreddit = read_string(in);
+		unsigned long long number_of_first_level = read_length(in);
+		for (unsigned long long j = 0; j < number_of_first_level && in.good(); ++j) {
+			subreddits.shared_insert(subreddit, read_string(in), "", true, -1);
+		}
+		unsigned long long number_of_other_level = read_length(in);
+		for (unsigned long long j = 0; j < number_of_other_level && in.good(); ++j) {
+			string id = read_string(in);
+			string parent_id = read_string(in);
+			subreddits.shared_insert(subreddit, id, parent_id, false, -1);
+		}
+	}
+	return in.good();
+}
+
+// the thread function of the reducer, reads one partial result.
+void do_reduce_work(string path, Subreddits& subreddits, bool& ok) {
+	ok = read_partial(path, subreddits);
+}
 
 // This class is responsible of providing a thread safe way to iterate through the 
 // subreddits. 
 class SharedMapReader {
 	mutex mu_read;
 	Subreddits* subreddits;
-	unordered_map<string, SubredditMetaData>::iterator subreddit_iterator;
+	FlatHashMap<string, SubredditMetaData>::iterator subreddit_iterator;
 public:
 	SharedMapReader(Subreddits* s) {
 		subreddits = s;
@@ -259,14 +691,16 @@ public:
 //   3. add the comment to the subreddits
 //        - We already know that if the link_id is equal to parent_id then the comment is
 //          the first in the thread.
-void do_work(SharedFileReader& reader, Subreddits& subreddits) {
+//   - in bucketed mode we also save the day of the thread starter comments.
+void do_work(SharedFileReader& reader, Subreddits& subreddits, bool bucketed) {
 	for (string line; reader.shared_read(line); ) {
 		auto json_line = json::parse(line.c_str());
 		string subreddit = json_line["subreddit"];
 		string parent_id = json_line["parent_id"];
 		string link_id = json_line["link_id"];
 		string id = json_line["name"];
-		subreddits.shared_insert(subreddit, id, parent_id, (link_id == parent_id));
+		long day = bucketed ? day_of(get_created_utc(json_line)) : -1;
+		subreddits.shared_insert(subreddit, id, parent_id, (link_id == parent_id), day);
 	}
 
 }
@@ -290,6 +724,33 @@ double calculate_average_dist(vector<int> levels) {
 	return 0;
 }
 
+// Subreddits with at least this many comments are too big to be processed by one
+// thread (AskReddit alone would keep a single core busy while the rest are idle), so
+// their depths are computed by all the threads together (see find_deepest_in_parallel)
+// before the other subreddits are distributed between the threads.
+// GIANT_SUBREDDIT_COMMENTS can be set when compiling, the checks and the benchmark of
+// tools/ build a version with a small threshold to run this on small inputs.
+#ifndef GIANT_SUBREDDIT_COMMENTS
+#define GIANT_SUBREDDIT_COMMENTS (1 << 20)
+#endif
+const size_t PARALLEL_THRESHOLD = GIANT_SUBREDDIT_COMMENTS;
+const int THREADS = 8;
+
+bool is_giant(SubredditMetaData& metadata) {
+	return metadata.get_first_level()->size() + metadata.get_other_level()->size() >= PARALLEL_THRESHOLD;
+}
+
+// runs work(0), ..., work(THREADS - 1) on their own threads, and waits for all of them.
+void run_on_threads(function<void(int)> work) {
+	vector<thread> threads;
+	for (int i = 0; i < THREADS; ++i) {
+		threads.push_back(thread(work, i));
+	}
+	for (auto& t : threads) {
+		t.join();
+	}
+}
+
 // this is the function that all the threads will execute in the second phase, basically thi is
 // the data processing part. 
 //    1. Grab the next subreddit from the subreddits (until end of subreddits)
@@ -301,14 +762,22 @@ double calculate_average_dist(vector<int> levels) {
 //           - we repeat this process until we can't find the parent of any node in
 //             the other_level
 // in the end we calculate the average depth and add it to the toplist.
-void do_sorting_work(SharedMapReader& reader, Subreddits& subreddits, TopList& top) {
+// The giant subreddits are skipped, they are done by find_deepest_in_parallel.
+void do_sorting_work(SharedMapReader& reader, Subreddits& subreddits, TopList& top, BucketedLevels* bucketed_levels) {
 	// grab next subreddit
 	for (auto subreddit = reader.getNext(); subreddit != subreddits.getMap()->end(); subreddit = reader.getNext()) {
+		if (is_giant(subreddit->second)) {
+			continue;
+		}
 		string subreddit_name = subreddit->first;
+		// in bucketed mode every comment inherits the day of it's thread starter.
+		bool bucketed = !subreddit->second.get_buckets()->empty();
+		int level = 0;
 		int moved = -1;
 		while (moved != 0) {
-			unordered_set<string> next_level_base;
+			FlatHashSet<string> next_level_base;
 			vector<Node> next_level_high;
+			FlatHashMap<string, long> next_buckets;
 			moved = 0;
 
 			// go through all the nodes that we don't know the parent yet
@@ -317,6 +786,9 @@ void do_sorting_work(SharedMapReader& reader, Subreddits& subreddits, TopList& t
 				if (subreddit->second.get_first_level()->count(current_node->get_parent_id()) != 0) {
 					moved++;
 					next_level_base.insert(current_node->get_id());
+					if (bucketed) {
+						next_buckets[current_node->get_id()] = subreddit->second.get_buckets()->at(current_node->get_parent_id());
+					}
 				}
 				// else we save it as well but in an other vector
 				else {
@@ -330,12 +802,29 @@ void do_sorting_work(SharedMapReader& reader, Subreddits& subreddits, TopList& t
 			// and always search for parent connections until we end up having no more.
 			if (moved != 0) {
 				subreddit->second.add_level(subreddit->second.get_first_level()->size() - next_level_base.size());
+				// the same difference, but counted separately for every day.
+				if (bucketed) {
+					for (const auto& comment : *subreddit->second.get_buckets()) {
+						subreddit->second.add_bucket_level(comment.second, level, 1);
+					}
+					for (const auto& comment : next_buckets) {
+						subreddit->second.add_bucket_level(comment.second, level, -1);
+					}
+					subreddit->second.set_buckets(next_buckets);
+				}
 				subreddit->second.set_first_level(next_level_base);
 				subreddit->second.set_other_level(next_level_high);
+				level++;
 			}
 		}
 		// in the end we add the last level's number to levels
 		subreddit->second.add_level(subreddit->second.get_first_level()->size());
+		if (bucketed) {
+			for (const auto& comment : *subreddit->second.get_buckets()) {
+				subreddit->second.add_bucket_level(comment.second, level, 1);
+			}
+			bucketed_levels->shared_add(subreddit_name, subreddit->second.get_bucket_levels());
+		}
 
 		// calculate average depth and add it to the toplist.
 		top.add(Pair(subreddit_name, calculate_average_dist(subreddit->second.get_levels())));
@@ -344,45 +833,227 @@ void do_sorting_work(SharedMapReader& reader, Subreddits& subreddits, TopList& t
 }
 
 
-int main()
-{
-	// we first create shared assets and pass their reference for the threads, as well as
-	// provide the function to execute. 
-	SharedFileReader file_reader;
-	Subreddits subreddits;
+// A comment id in the maps of find_deepest_in_parallel: a pointer to the id in the
+// subreddit's own sets, so the ids are not copied, and it's hash, which is computed
+// only once. Two of them are equal if the ids are, and the maps can be searched with a
+// string as well.
+class CommentRef {
+public:
+	const string* id;
+	size_t hash;
 
-	thread t1(do_work, ref(file_reader), ref(subreddits));
-	thread t2(do_work, ref(file_reader), ref(subreddits));
-	thread t3(do_work, ref(file_reader), ref(subreddits));
-	thread t4(do_work, ref(file_reader), ref(subreddits));
-	thread t5(do_work, ref(file_reader), ref(subreddits));
-	thread t6(do_work, ref(file_reader), ref(subreddits));
-	thread t7(do_work, ref(file_reader), ref(subreddits));
-	thread t8(do_work, ref(file_reader), ref(subreddits));
+	CommentRef() {
+		id = nullptr;
+		hash = 0;
+	}
 
-	// wait for every thread to finish.
-	t1.join();
-	t2.join();
-	t3.join();
-	t4.join();
-	t5.join();
-	t6.join();
-	t7.join();
-	t8.join();
-	cout << "Finished with first multithreadding..." << endl;
+	CommentRef(const string* id_in, size_t hash_in) {
+		id = id_in;
+		hash = hash_in;
+	}
 
-	// create every asset for the second part and distribute them to the new threads.
+	bool operator==(const CommentRef& other) const {
+		return hash == other.hash && *id == *other.id;
+	}
+
+	bool operator==(const string& other) const {
+		return *id == other;
+	}
+};
+
+struct CommentRefHash {
+	size_t operator()(const CommentRef& key) const {
+		return key.hash;
+	}
+
+	size_t operator()(const string& key) const {
+		return FlatHash<string>()(key);
+	}
+};
+
+// Computes the same levels as do_sorting_work for one (giant) subreddit, but with all
+// the threads working on it:
+//   1. every comment gets a number (thread starters first). The ids are hashed once,
+//      by THREADS slices, and every slice sorts it's numbers into THREADS parts by the
+//      hash. Then each thread fills the map of one part (id -> number) from the parts
+//      of the slices, so there is no locking, and no id is hashed twice.
+//   2. every comment looks up the number of it's parent, these form a flat array of
+//      parents (the thread starters are their own parents, and the comments whose
+//      parent is not in the subreddit get -1).
+//   3. pointer jumping: in every round each comment adds the depth of the comment it
+//      points to to it's own, and points to where that one points, so after round r
+//      every comment points 2^r levels up (or to it's thread starter). Every round
+//      processes the array in THREADS slices, so after log2(longest chain) rounds every
+//      comment knows it's depth.
+//   4. every thread counts the depths (and in bucketed mode the days of the thread
+//      starters) of it's slice, and the counts are turned into the levels.
+// Comments which never reach a thread starter (the parent is missing, or the ids form
+// a cycle) are not counted, just like in do_sorting_work.
+void find_deepest_in_parallel(string subreddit_name, SubredditMetaData& metadata, TopList& top, BucketedLevels* bucketed_levels) {
+	bool bucketed = !metadata.get_buckets()->empty();
+	vector<const string*> ids;
+	ids.reserve(metadata.get_first_level()->size() + metadata.get_other_level()->size());
+	for (const auto& id : *metadata.get_first_level()) {
+		ids.push_back(&id);
+	}
+	long first_level_size = ids.size();
+	for (const auto& node : *metadata.get_other_level()) {
+		ids.push_back(&node.get_id());
+	}
+	long size = ids.size();
+	FlatHash<string> hash;
+
+	// 1. the hashes, and the numbers of every part by slices.
+	vector<size_t> hashes(size);
+	vector<vector<vector<long>>> parts(THREADS, vector<vector<long>>(THREADS));
+	run_on_threads([&](int slice) {
+		for (long i = size * slice / THREADS; i < size * (slice + 1) / THREADS; ++i) {
+			hashes[i] = hash(*ids[i]);
+			parts[slice][hashes[i] % THREADS].push_back(i);
+		}
+	});
+	// the id -> number maps. The slices are in order, so if an id appears more than
+	// once, the first one is kept.
+	vector<FlatHashMap<CommentRef, long, CommentRefHash>> numbers(THREADS);
+	run_on_threads([&](int part) {
+		size_t part_size = 0;
+		for (int slice = 0; slice < THREADS; ++slice) {
+			part_size += parts[slice][part].size();
+		}
+		numbers[part].reserve(part_size);
+		for (int slice = 0; slice < THREADS; ++slice) {
+			for (const auto& i : parts[slice][part]) {
+				numbers[part].insert(make_pair(CommentRef(ids[i], hashes[i]), i));
+			}
+			vector<long>().swap(parts[slice][part]);
+		}
+	});
+	auto number_of = [&](const CommentRef& id) {
+		FlatHashMap<CommentRef, long, CommentRefHash>& part = numbers[id.hash % THREADS];
+		auto element = part.find(id);
+		return element == part.end() ? -1 : element->second;
+	};
+
+	// 2. the parents, and the depth relative to them.
+	vector<long> parent(size), next_parent(size);
+	vector<long> depth(size), next_depth(size);
+	run_on_threads([&](int part) {
+		for (long i = size * part / THREADS; i < size * (part + 1) / THREADS; ++i) {
+			if (i < first_level_size) {
+				parent[i] = i;
+				depth[i] = 0;
+			}
+			else {
+				const string& parent_id = (*metadata.get_other_level())[i - first_level_size].get_parent_id();
+				parent[i] = number_of(CommentRef(&parent_id, hash(parent_id)));
+				depth[i] = 1;
+			}
+		}
+	});
+
+	// 3. pointer jumping, until nothing changes. A real depth can't be bigger than the
+	// number of comments, so a comment going over it is in a cycle, and it's dropped.
+	vector<char> changed(THREADS, 1);
+	while (find(changed.begin(), changed.end(), 1) != changed.end()) {
+		run_on_threads([&](int part) {
+			changed[part] = 0;
+			for (long i = size * part / THREADS; i < size * (part + 1) / THREADS; ++i) {
+				long p = parent[i];
+				next_parent[i] = p;
+				next_depth[i] = depth[i];
+				if (p < 0 || parent[p] == p) {
+					continue;
+				}
+				changed[part] = 1;
+				next_parent[i] = parent[p];
+				next_depth[i] = depth[i] + depth[p];
+				if (next_parent[i] < 0 || next_depth[i] > size) {
+					next_parent[i] = -1;
+				}
+			}
+		});
+		parent.swap(next_parent);
+		depth.swap(next_depth);
+	}
+
+	// 4. counting the comments on every depth (and on every day in bucketed mode). Only
+	// the first of the comments with the same id is counted.
+	vector<vector<long>> counts(THREADS);
+	vector<map<long, vector<long>>> bucket_counts(THREADS);
+	run_on_threads([&](int part) {
+		for (long i = size * part / THREADS; i < size * (part + 1) / THREADS; ++i) {
+			if (parent[i] < 0 || number_of(CommentRef(ids[i], hashes[i])) != i) {
+				continue;
+			}
+			if (counts[part].size() <= (size_t)depth[i]) {
+				counts[part].resize(depth[i] + 1, 0);
+			}
+			counts[part][depth[i]]++;
+			if (bucketed) {
+				vector<long>& day_counts = bucket_counts[part][metadata.get_buckets()->at(*ids[parent[i]])];
+				if (day_counts.size() <= (size_t)depth[i]) {
+					day_counts.resize(depth[i] + 1, 0);
+				}
+				day_counts[depth[i]]++;
+			}
+		}
+	});
+
+	// levels[i] is the number of comments on depth i minus the number on depth i + 1,
+	// and the number on the deepest level in the end (see do_sorting_work).
+	vector<long> total(1, 0);
+	map<long, vector<long>> total_by_day;
+	for (int part = 0; part < THREADS; ++part) {
+		if (total.size() < counts[part].size()) {
+			total.resize(counts[part].size(), 0);
+		}
+		for (size_t d = 0; d < counts[part].size(); ++d) {
+			total[d] += counts[part][d];
+		}
+		for (const auto& day : bucket_counts[part]) {
+			vector<long>& day_total = total_by_day[day.first];
+			if (day_total.size() < day.second.size()) {
+				day_total.resize(day.second.size(), 0);
+			}
+			for (size_t d = 0; d < day.second.size(); ++d) {
+				day_total[d] += day.second[d];
+			}
+		}
+	}
+	for (size_t d = 0; d < total.size(); ++d) {
+		metadata.add_level(total[d] - (d + 1 < total.size() ? total[d + 1] : 0));
+	}
+	if (bucketed) {
+		for (const auto& day : total_by_day) {
+			for (size_t d = 0; d < day.second.size(); ++d) {
+				metadata.add_bucket_level(day.first, d, day.second[d] - (d + 1 < day.second.size() ? day.second[d + 1] : 0));
+			}
+		}
+		bucketed_levels->shared_add(subreddit_name, metadata.get_bucket_levels());
+	}
+
+	top.add(Pair(subreddit_name, calculate_average_dist(metadata.get_levels())));
+}
+
+// The whole second phase on the given subreddits: the giant subreddits first, one after
+// the other, each with all the threads, then the rest with one thread for each.
+void find_deepest(Subreddits& subreddits, TopList& top, BucketedLevels* bucketed_levels) {
 	SharedMapReader map_reader(&subreddits);
-	TopList top(10);
 
-	thread t11(do_sorting_work, ref(map_reader), ref(subreddits), ref(top));
-	thread t12(do_sorting_work, ref(map_reader), ref(subreddits), ref(top));
-	thread t13(do_sorting_work, ref(map_reader), ref(subreddits), ref(top));
-	thread t14(do_sorting_work, ref(map_reader), ref(subreddits), ref(top));
-	thread t15(do_sorting_work, ref(map_reader), ref(subreddits), ref(top));
-	thread t16(do_sorting_work, ref(map_reader), ref(subreddits), ref(top));
-	thread t17(do_sorting_work, ref(map_reader), ref(subreddits), ref(top));
-	thread t18(do_sorting_work, ref(map_reader), ref(subreddits), ref(top));
+	for (auto subreddit = subreddits.getMap()->begin(); subreddit != subreddits.getMap()->end(); ++subreddit) {
+		if (is_giant(subreddit->second)) {
+			find_deepest_in_parallel(subreddit->first, subreddit->second, top, bucketed_levels);
+		}
+	}
+
+	thread t11(do_sorting_work, ref(map_reader), ref(subreddits), ref(top), bucketed_levels);
+	thread t12(do_sorting_work, ref(map_reader), ref(subreddits), ref(top), bucketed_levels);
+	thread t13(do_sorting_work, ref(map_reader), ref(subreddits), ref(top), bucketed_levels);
+	thread t14(do_sorting_work, ref(map_reader), ref(subreddits), ref(top), bucketed_levels);
+	thread t15(do_sorting_work, ref(map_reader), ref(subreddits), ref(top), bucketed_levels);
+	thread t16(do_sorting_work, ref(map_reader), ref(subreddits), ref(top), bucketed_levels);
+	thread t17(do_sorting_work, ref(map_reader), ref(subreddits), ref(top), bucketed_levels);
+	thread t18(do_sorting_work, ref(map_reader), ref(subreddits), ref(top), bucketed_levels);
 
 	// wait for all of them to finish
 	t11.join();
@@ -393,8 +1064,839 @@ int main()
 	t16.join();
 	t17.join();
 	t18.join();
+}
+
+// The second phase of the spilled partitions (--memory-limit): every spilled partition
+// is read back into it's own Subreddits, together with the comments of it that were
+// still in memory, and resolved by the normal second phase. So only one partition has
+// to fit into the memory (besides the partitions which were never spilled).
+bool find_deepest_spilled(Subreddits& subreddits, TopList& top, BucketedLevels* bucketed_levels) {
+	bool ok = true;
+	for (int partition = 0; partition < SPILL_PARTITIONS; ++partition) {
+		if (subreddits.is_spilled(partition)) {
+			Subreddits block;
+			ok = subreddits.load_spilled(partition, block) && ok;
+			find_deepest(block, top, bucketed_levels);
+		}
+	}
+	return ok;
+}
+
+// prints a toplist for every subreddit's levels in a bucket.
+void print_bucket(FlatHashMap<string, vector<int>>& bucket) {
+	TopList top(10);
+	for (auto subreddit = bucket.begin(); subreddit != bucket.end(); ++subreddit) {
+		top.add(Pair(subreddit->first, calculate_average_dist(subreddit->second)));
+	}
+	top.print();
+}
+
+// Query server mode. After both phases, instead of printing the toplist and exiting,
+// we keep every subreddit's levels in memory and answer queries read from the standard
+// input, one per line, so the file does not have to be processed again for every
+// variation of the question:
+//   top <k>            the k subreddits with the deepest threads on average
+//   depth <subreddit>  the average depth of one subreddit
+//   memory             the estimated memory used by each index
+//   quit
+// Every answer is closed by an "ok" line (or starts with "error"), followed by the time
+// it took to answer. forest_memory is the size of the comment forests before the second
+// phase, as the second phase consumes them.
+void serve(Subreddits& subreddits, size_t forest_memory) {
+	cout << "ready" << endl;
+	for (string line; getline(cin, line); ) {
+		istringstream iss(line);
+		string command;
+		iss >> command;
+		if (command.empty()) {
+			continue;
+		}
+		if (command == "quit") {
+			break;
+		}
+		auto start = chrono::steady_clock::now();
+		if (command == "top") {
+			int number = 10;
+			iss >> number;
+			if (number <= 0) {
+				cout << "error: k must be positive" << endl;
+				continue;
+			}
+			// there are no more subreddits to list than we have.
+			number = (int)min((size_t)number, subreddits.getMap()->size());
+			TopList top(number);
+			for (auto subreddit = subreddits.getMap()->begin(); subreddit != subreddits.getMap()->end(); ++subreddit) {
+				top.add(Pair(subreddit->first, calculate_average_dist(subreddit->second.get_levels())));
+			}
+			top.print();
+		}
+		else if (command == "depth") {
+			string subreddit;
+			iss >> subreddit;
+			if (!subreddits.contains(subreddit)) {
+				cout << "error: unknown subreddit " << subreddit << endl;
+				continue;
+			}
+			cout << subreddit << ": " << calculate_average_dist(subreddits.get_meta_data(subreddit)->get_levels()) << endl;
+		}
+		else if (command == "memory") {
+			cout << "comment forests: " << subreddits.getMap()->size() << " subreddits, " << forest_memory << " bytes before the second phase, " << subreddits.memory_usage() << " bytes now" << endl;
+		}
+		else {
+			cout << "error: unknown command " << command << endl;
+			continue;
+		}
+		auto elapsed = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start);
+		cout << "ok " << elapsed.count() / 1000.0 << " ms" << endl;
+	}
+}
+
+// Streaming mode (--streaming). Instead of storing every comment and finding the
+// parents in a second phase, the depth of a comment is resolved as soon as it arrives,
+// if the depth of it's parent is already known. If the parent did not arrive yet, the
+// comment waits in the pending index of the subreddit (parent id -> child ids), and
+// when the parent shows up, it's waiting children (and their waiting children...) are
+// resolved in a cascade. 
+//
+// The average the second phase computes from the levels is (sum of i * levels[i]) /
+// (sum of levels[i]), and as levels[i] is the number of comments at depth i minus the
+// number at depth i + 1, this is (number of resolved comments - number of thread
+// starters) / number of thread starters. So we only need these running counters for
+// the result, and a resolved comment only needs it's depth for it's later children:
+// it is kept as a number (the base36 id) instead of strings, and only the unresolved
+// comments are stored with their parent.
+//
+// A reply can come at any time later in the file, so by default the resolved comments
+// are kept until the end, and the memory still grows with every comment (a slot of the
+// resolved map), only slower than with the comment forests. With --retention <hours>
+// a resolved comment is dropped once the subreddit has a comment that many hours newer
+// (by created_utc), so the memory only grows with the unresolved comments and the
+// comments of the window. A reply to a dropped comment (a late orphan) can't be
+// resolved any more: reddit ids grow with the time, so an unresolved parent with an id
+// below the largest dropped id of the subreddit is taken as dropped, the reply is
+// counted and thrown away (it's own replies then wait until the end). Every late
+// orphan is missing from the resolved comments, so the average of it's subreddit is
+// too low by at least late orphans / thread starters, which is printed in the end.
+
+// converts a reddit id (e.g. t1_c3v7f8u) to a number: the base36 part, with the type
+// digit in the lowest 3 bits. Anything else is hashed.
+unsigned long long comment_key(const string& id) {
+	if (id.size() > 3 && id[0] == 't' && id[2] == '_' && id.size() <= 15) {
+		unsigned long long value = 0;
+		for (size_t i = 3; i < id.size(); ++i) {
+			char c = id[i];
+			if (c >= '0' && c <= '9') {
+				value = value * 36 + (c - '0');
+			}
+			else if (c >= 'a' && c <= 'z') {
+				value = value * 36 + (c - 'a' + 10);
+			}
+			else {
+				return hash<string>()(id) | (1ULL << 63);
+			}
+		}
+		return (value << 3) | (id[1] & 7);
+	}
+	return hash<string>()(id) | (1ULL << 63);
+}
+
+class StreamingMetaData {
+	// depth of every resolved comment (of the window, with a retention).
+	FlatHashMap<unsigned long long, int> resolved;
+	// unresolved comments, by the id of their parent.
+	FlatHashMap<unsigned long long, vector<unsigned long long>> pending;
+	// with a retention: the resolved comments in the order of their resolution, with the
+	// newest created_utc of the subreddit at that time, the oldest first.
+	deque<pair<long, unsigned long long>> window;
+	long newest;
+	unsigned long long largest_dropped;
+	long number_of_pending;
+	long number_of_starters;
+	long number_of_resolved;
+	long number_of_late_orphans;
+
+	// drops the resolved comments which are more than retention seconds older than the
+	// newest comment.
+	void drop_old(long retention) {
+		while (!window.empty() && window.front().first < newest - retention) {
+			resolved.erase(window.front().second);
+			if (window.front().second < (1ULL << 63)) {
+				largest_dropped = max(largest_dropped, window.front().second);
+			}
+			window.pop_front();
+		}
+	}
+public:
+	StreamingMetaData() {
+		newest = LONG_MIN;
+		largest_dropped = 0;
+		number_of_pending = 0;
+		number_of_starters = 0;
+		number_of_resolved = 0;
+		number_of_late_orphans = 0;
+	}
+
+	// adds a comment, and resolves it (and it's waiting children) if possible. The
+	// created_utc is only used with a retention (in seconds, 0 keeps everything).
+	// returns the change in the number of pending comments.
+	long add(unsigned long long id, unsigned long long parent_id, bool isFirstLevel, long created_utc, long retention) {
+		int depth = 0;
+		if (retention > 0 && created_utc > newest) {
+			newest = created_utc;
+			drop_old(retention);
+		}
+		if (isFirstLevel) {
+			number_of_starters++;
+		}
+		else {
+			auto parent = resolved.find(parent_id);
+			if (parent == resolved.end()) {
+				if (parent_id <= largest_dropped) {
+					number_of_late_orphans++;
+					return 0;
+				}
+				pending[parent_id].push_back(id);
+				number_of_pending++;
+				return 1;
+			}
+			depth = parent->second + 1;
+		}
+		// the cascade, with a stack instead of recursion as threads can be very deep.
+		long before = number_of_pending;
+		vector<pair<unsigned long long, int>> stack;
+		stack.push_back(make_pair(id, depth));
+		while (!stack.empty()) {
+			pair<unsigned long long, int> current = stack.back();
+			stack.pop_back();
+			resolved[current.first] = current.second;
+			number_of_resolved++;
+			if (retention > 0) {
+				window.push_back(make_pair(newest, current.first));
+			}
+			auto children = pending.find(current.first);
+			if (children != pending.end()) {
+				for (const auto& child : children->second) {
+					stack.push_back(make_pair(child, current.second + 1));
+				}
+				number_of_pending -= children->second.size();
+				pending.erase(children);
+			}
+		}
+		return number_of_pending - before;
+	}
+
+	// same as calculate_average_dist on the levels of the second phase.
+	double get_average() {
+		if (number_of_starters == 0) {
+			return 0;
+		}
+		return (number_of_resolved - number_of_starters) / (double)number_of_starters;
+	}
+
+	// how much too low the average is at least because of the late orphans.
+	double get_late_orphan_error() {
+		return number_of_starters > 0 ? number_of_late_orphans / (double)number_of_starters : 0;
+	}
+
+	long get_number_of_pending() {
+		return number_of_pending;
+	}
+
+	long get_number_of_resolved() {
+		return number_of_resolved;
+	}
+
+	long get_number_of_kept() {
+		return resolved.size();
+	}
+
+	long get_number_of_late_orphans() {
+		return number_of_late_orphans;
+	}
+
+	// number of bytes used by the resolved and the pending comments.
+	size_t memory_usage() {
+		size_t bytes = sizeof(StreamingMetaData) + resolved.memory_usage() + pending.memory_usage() + window.size() * sizeof(pair<long, unsigned long long>);
+		for (const auto& children : pending) {
+			bytes += children.second.capacity() * sizeof(unsigned long long);
+		}
+		return bytes;
+	}
+};
+
+// StreamingSubreddits is the Subreddits of the streaming mode. It also tracks the number
+// of unresolved comments (and it's peak), as the pending index is the part of the
+// memory which depends on the order of the comments. The subreddits are divided into
+// STREAMING_SHARDS shards by the hash of their name, every shard with it's own map and
+// lock, as a comment only touches it's own subreddit. The running top list of the
+// progressive mode has a lock of it's own, and a worker skips the update when an other
+// one holds it (the next comment of the subreddit updates it again), so the workers
+// don't wait for each other there either.
+const int STREAMING_SHARDS = 16;
+
+class StreamingSubreddits {
+	mutex mu_write[STREAMING_SHARDS];
+	FlatHashMap<string, StreamingMetaData> maps[STREAMING_SHARDS];
+	long retention;
+	atomic<long> number_of_pending;
+	atomic<long> peak_number_of_pending;
+	// the running top list of the progressive mode, null if it's off.
+	mutex mu_progress;
+	ProgressiveTopList* progress;
+public:
+	// the retention is in seconds, 0 keeps every resolved comment.
+	StreamingSubreddits(long retention_in) {
+		retention = retention_in;
+		number_of_pending = 0;
+		peak_number_of_pending = 0;
+		progress = nullptr;
+	}
+
+	// turns on the progressive mode, has to be called before the first insert.
+	void set_progress(ProgressiveTopList* progress_in) {
+		progress = progress_in;
+	}
+
+	// thread-safe, the ids are converted before locking.
+	void shared_insert(string subreddit, string id, string parent_id, bool isFirstLevel, long created_utc) {
+		unsigned long long id_key = comment_key(id);
+		unsigned long long parent_key = comment_key(parent_id);
+		int shard = hash<string>()(subreddit) % STREAMING_SHARDS;
+		lock_guard<mutex> locker(mu_write[shard]);
+		StreamingMetaData& metadata = maps[shard][subreddit];
+		long pending = number_of_pending += metadata.add(id_key, parent_key, isFirstLevel, created_utc, retention);
+		long peak = peak_number_of_pending;
+		while (pending > peak && !peak_number_of_pending.compare_exchange_weak(peak, pending)) {
+		}
+		if (progress != nullptr && mu_progress.try_lock()) {
+			progress->update(subreddit, metadata.get_average());
+			mu_progress.unlock();
+		}
+	}
+
+	// after the data gathering: updates the running list with every subreddit, as the
+	// workers may have skipped the last updates.
+	void update_progress() {
+		for (int shard = 0; shard < STREAMING_SHARDS; ++shard) {
+			for (auto element = maps[shard].begin(); element != maps[shard].end(); ++element) {
+				progress->update(element->first, element->second.get_average());
+			}
+		}
+	}
+
+	long get_number_of_pending() {
+		return number_of_pending;
+	}
+
+	long get_peak_number_of_pending() {
+		return peak_number_of_pending;
+	}
+
+	// Not thread-safe, only used after the data gathering: adds every subreddit to the
+	// top list, and prints the counters of the comments and the memory.
+	void finish(TopList& top) {
+		long resolved = 0, kept = 0, late_orphans = 0;
+		size_t bytes = sizeof(StreamingSubreddits);
+		Pair worst;
+		for (int shard = 0; shard < STREAMING_SHARDS; ++shard) {
+			bytes += maps[shard].memory_usage();
+			for (auto element = maps[shard].begin(); element != maps[shard].end(); ++element) {
+				top.add(Pair(element->first, element->second.get_average()));
+				resolved += element->second.get_number_of_resolved();
+				kept += element->second.get_number_of_kept();
+				late_orphans += element->second.get_number_of_late_orphans();
+				bytes += memory_of(element->first) + element->second.memory_usage();
+				if (element->second.get_late_orphan_error() > worst.getValue()) {
+					worst = Pair(element->first, element->second.get_late_orphan_error());
+				}
+			}
+		}
+		cout << "Unresolved comments: " << number_of_pending << " (at most " << peak_number_of_pending << " during the run)" << endl;
+		if (retention > 0) {
+			cout << "Resolved comments: " << resolved << " (" << kept << " kept in the last " << retention / 3600 << " hours), " << bytes / 1048576.0 << " Mb in all" << endl;
+			cout << "Late orphans: " << late_orphans << " (replies to dropped comments, every average is too low by at least it's late orphans per thread starter, the most is " << worst.getValue();
+			cout << (worst.getSubreddit().empty() ? string("") : " in " + worst.getSubreddit()) << ")" << endl;
+		}
+		else {
+			cout << "Resolved comments: " << resolved << " (kept until the end), " << bytes / 1048576.0 << " Mb in all" << endl;
+		}
+	}
+};
+
+// the only phase of the streaming mode (the created_utc is only read with a retention).
+void do_streaming_work(SharedFileReader& reader, StreamingSubreddits& subreddits, bool timed) {
+	for (string line; reader.shared_read(line); ) {
+		auto json_line = json::parse(line.c_str());
+		string parent_id = json_line["parent_id"];
+		string link_id = json_line["link_id"];
+		subreddits.shared_insert(json_line["subreddit"], json_line["name"], parent_id, (link_id == parent_id), timed ? get_created_utc(json_line) : 0);
+	}
+}
+
+// runs the whole streaming mode and prints the toplist (and the running top list at
+// every progress_interval seconds, if it's not 0). The retention is in hours, 0 keeps
+// every resolved comment.
+void find_deepest_streaming(SharedFileReader& file_reader, int progress_interval, long retention) {
+	StreamingSubreddits subreddits(retention * 3600);
+	ProgressiveTopList progress(10);
+	thread printer;
+	if (progress_interval > 0) {
+		subreddits.set_progress(&progress);
+		printer = thread(do_progress_work, ref(progress), progress_interval, 10);
+	}
+
+	bool timed = retention > 0;
+	thread t1(do_streaming_work, ref(file_reader), ref(subreddits), timed);
+	thread t2(do_streaming_work, ref(file_reader), ref(subreddits), timed);
+	thread t3(do_streaming_work, ref(file_reader), ref(subreddits), timed);
+	thread t4(do_streaming_work, ref(file_reader), ref(subreddits), timed);
+	thread t5(do_streaming_work, ref(file_reader), ref(subreddits), timed);
+	thread t6(do_streaming_work, ref(file_reader), ref(subreddits), timed);
+	thread t7(do_streaming_work, ref(file_reader), ref(subreddits), timed);
+	thread t8(do_streaming_work, ref(file_reader), ref(subreddits), timed);
+	t1.join();
+	t2.join();
+	t3.join();
+	t4.join();
+	t5.join();
+	t6.join();
+	t7.join();
+	t8.join();
+	if (progress_interval > 0) {
+		subreddits.update_progress();
+		progress.finish();
+		printer.join();
+	}
+	cout << "Finished with streaming..." << endl;
+
+	TopList top(10);
+	subreddits.finish(top);
+	top.print();
+}
+
+// The comments of a thread are spread over the file, so the depths can't be computed
+// from a sample (the parents are mostly not in it). But the average of the second
+// phase is (comments - thread starters) / thread starters (see StreamingSubreddits), a
+// ratio, so it does not even have to be scaled up: it's estimated by the same ratio
+// in the sample. This assumes that every comment's thread starter is in the file.
+// For every subreddit we count the thread starters and the other comments in the
+// sample, and weighted by every replicate.
+class SampledCounts {
+public:
+	double starters, others;
+	vector<double> replicate_starters, replicate_others;
+
+	SampledCounts() {
+		starters = 0;
+		others = 0;
+		replicate_starters.assign(REPLICATES, 0);
+		replicate_others.assign(REPLICATES, 0);
+	}
+};
+
+double estimate_average(double starters, double others) {
+	return starters > 0 ? others / starters : 0;
+}
+
+class SampledSubreddits {
+	mutex mu_write;
+	FlatHashMap<string, SampledCounts> map;
+public:
+	// thread-safe, counts one sampled comment with it's weight in every replicate.
+	void shared_insert(string subreddit, bool isFirstLevel, const vector<int>& weights) {
+		lock_guard<mutex> locker(mu_write);
+		SampledCounts& counts = map[subreddit];
+		(isFirstLevel ? counts.starters : counts.others) += 1;
+		vector<double>& replicate_counts = isFirstLevel ? counts.replicate_starters : counts.replicate_others;
+		for (int replicate = 0; replicate < REPLICATES; ++replicate) {
+			replicate_counts[replicate] += weights[replicate];
+		}
+	}
+
+	// the estimate of every subreddit, and the same in every replicate (see print_sampled_toplist).
+	void estimate(vector<string>& names, vector<double>& estimates, vector<vector<double>>& replicates) {
+		replicates.assign(REPLICATES, vector<double>());
+		for (auto element = map.begin(); element != map.end(); ++element) {
+			names.push_back(element->first);
+			estimates.push_back(estimate_average(element->second.starters, element->second.others));
+			for (int replicate = 0; replicate < REPLICATES; ++replicate) {
+				replicates[replicate].push_back(estimate_average(element->second.replicate_starters[replicate], element->second.replicate_others[replicate]));
+			}
+		}
+	}
+};
+
+// the data gathering of the sampling mode, we only need to know whether the comment is
+// a thread starter. The weights of the line are computed before taking the lock, and
+// only once for every block, as they are the weights of the block.
+void do_sample_work(SharedFileReader& reader, SampledSubreddits& sampled) {
+	vector<int> weights(REPLICATES);
+	int file;
+	long long offset;
+	unsigned long long weighted_block = 0;
+	bool weighted = false;
+	for (string line; reader.shared_read(line, file, offset); ) {
+		auto json_line = json::parse(line.c_str());
+		string subreddit = json_line["subreddit"];
+		string parent_id = json_line["parent_id"];
+		string link_id = json_line["link_id"];
+		unsigned long long block = sample_block(file, offset);
+		if (!weighted || block != weighted_block) {
+			for (int replicate = 0; replicate < REPLICATES; ++replicate) {
+				weights[replicate] = bootstrap_weight(block, replicate);
+			}
+			weighted_block = block;
+			weighted = true;
+		}
+		sampled.shared_insert(subreddit, link_id == parent_id, weights);
+	}
+}
+
+// reads the sample with 8 threads, and prints the number subreddits with the deepest
+// threads estimated from it.
+void find_deepest_in_sample(vector<string>& files, LineFilter& filter, double fraction, unsigned long long seed, int number) {
+	double sampled_fraction;
+	SharedFileReader file_reader(files, get_sample_ranges(files, fraction, seed, sampled_fraction), filter);
+	SampledSubreddits sampled;
+
+	thread t1(do_sample_work, ref(file_reader), ref(sampled));
+	thread t2(do_sample_work, ref(file_reader), ref(sampled));
+	thread t3(do_sample_work, ref(file_reader), ref(sampled));
+	thread t4(do_sample_work, ref(file_reader), ref(sampled));
+	thread t5(do_sample_work, ref(file_reader), ref(sampled));
+	thread t6(do_sample_work, ref(file_reader), ref(sampled));
+	thread t7(do_sample_work, ref(file_reader), ref(sampled));
+	thread t8(do_sample_work, ref(file_reader), ref(sampled));
+	t1.join();
+	t2.join();
+	t3.join();
+	t4.join();
+	t5.join();
+	t6.join();
+	t7.join();
+	t8.join();
+	cout << "Finished with first multithreadding..." << endl;
+
+	vector<string> names;
+	vector<double> estimates;
+	vector<vector<double>> replicates;
+	sampled.estimate(names, estimates, replicates);
+	cout << "Estimated from " << 100 * sampled_fraction << "% of the file (seed " << seed << "), with " << REPLICATES << " bootstrap replicates:" << endl;
+	print_sampled_toplist(names, estimates, replicates, sampled_fraction, number);
+}
+
+int main(int argc, char* argv[])
+{
+	// --buckets turns on the time-bucketed mode: top lists for every day and week.
+	// --serve keeps the results in memory and answers queries from the standard input.
+	// --input <path>... reads other files, directories or patterns instead of the default file.
+	// --shard <i>/<n> only reads the i-th of n equal parts of the input.
+	// --map <path> writes the partial result to the file instead of printing the list.
+	// --reduce <path>... merges the partial results instead of reading the input.
+	// --streaming resolves the depths while reading (see find_deepest_streaming).
+	// --retention <hours> drops the resolved comments of the streaming mode after that long.
+	// --sample <fraction> estimates the result from a random part of the file.
+	// --seed <n> draws the blocks of the sample with this seed instead of the default one.
+	// --build-index writes the block index of the input files (see build_index).
+	// --subreddit <name>... only reads the comments of the given subreddits.
+	// --since <date> and --until <date> only read the comments of these days.
+	// --memory-limit <Mb> spills the largest partitions to the disk above the limit.
+	// --spill <directory> writes the partitions of --memory-limit there.
+	// --progress <seconds> prints the estimated top list at every interval while reading.
+	bool bucketed = false;
+	bool streaming = false;
+	long retention = 0;
+	double sample_fraction = 0;
+	unsigned long long seed = DEFAULT_SEED;
+	bool seeded = false;
+	long long memory_limit = 0;
+	string spill_directory = ".";
+	int progress_interval = 0;
+	bool server = false;
+	bool building_index = false;
+	LineFilter filter;
+	long long since = LLONG_MIN, until = LLONG_MAX;
+	vector<string> inputs;
+	int shard = 0, shards = 1;
+	string map_path;
+	vector<string> partial_paths;
+	for (int i = 1; i < argc; ++i) {
+		if (string(argv[i]) == "--buckets") {
+			bucketed = true;
+		}
+		else if (string(argv[i]) == "--serve") {
+			server = true;
+		}
+		else if (string(argv[i]) == "--input") {
+			while (i + 1 < argc && string(argv[i + 1]).compare(0, 2, "--") != 0) {
+				inputs.push_back(argv[++i]);
+			}
+		}
+		else if (string(argv[i]) == "--shard" && i + 1 < argc) {
+			if (sscanf(argv[++i], "%d/%d", &shard, &shards) != 2 || shard < 0 || shard >= shards) {
+				cout << "error: --shard expects <i>/<n> with 0 <= i < n" << endl;
+				return 1;
+			}
+		}
+		else if (string(argv[i]) == "--map" && i + 1 < argc) {
+			map_path = argv[++i];
+		}
+		else if (string(argv[i]) == "--reduce") {
+			while (i + 1 < argc && string(argv[i + 1]).compare(0, 2, "--") != 0) {
+				partial_paths.push_back(argv[++i]);
+			}
+		}
+		else if (string(argv[i]) == "--streaming") {
+			streaming = true;
+		}
+		else if (string(argv[i]) == "--retention" && i + 1 < argc) {
+			retention = atol(argv[++i]);
+			if (retention <= 0) {
+				cout << "error: --retention expects a positive number of hours" << endl;
+				return 1;
+			}
+		}
+		else if (string(argv[i]) == "--sample" && i + 1 < argc) {
+			sample_fraction = atof(argv[++i]);
+			if (!(sample_fraction > 0 && sample_fraction <= 1)) {
+				cout << "error: --sample expects a fraction between 0 and 1" << endl;
+				return 1;
+			}
+		}
+		else if (string(argv[i]) == "--seed" && i + 1 < argc) {
+			seed = strtoull(argv[++i], nullptr, 10);
+			seeded = true;
+		}
+		else if (string(argv[i]) == "--memory-limit" && i + 1 < argc) {
+			memory_limit = atoll(argv[++i]);
+			if (memory_limit <= 0) {
+				cout << "error: --memory-limit expects a positive number of Mb" << endl;
+				return 1;
+			}
+		}
+		else if (string(argv[i]) == "--spill" && i + 1 < argc) {
+			spill_directory = argv[++i];
+		}
+		else if (string(argv[i]) == "--progress" && i + 1 < argc) {
+			progress_interval = atoi(argv[++i]);
+			if (progress_interval <= 0) {
+				cout << "error: --progress expects a positive number of seconds" << endl;
+				return 1;
+			}
+		}
+		else if (string(argv[i]) == "--build-index") {
+			building_index = true;
+		}
+		else if (string(argv[i]) == "--subreddit") {
+			while (i + 1 < argc && string(argv[i + 1]).compare(0, 2, "--") != 0) {
+				filter.add_subreddit(argv[++i]);
+			}
+		}
+		else if ((string(argv[i]) == "--since" || string(argv[i]) == "--until") && i + 1 < argc) {
+			bool is_until = string(argv[i]) == "--until";
+			if (!parse_date(argv[++i], is_until, is_until ? until : since)) {
+				cout << "error: " << argv[i - 1] << " expects a date (YYYY-MM-DD) or a unix timestamp" << endl;
+				return 1;
+			}
+		}
+		else {
+			cout << "error: unknown option " << argv[i] << " (or it's value is missing)" << endl;
+			return 1;
+		}
+	}
+	filter.set_time_range(since, until);
+	// the reducer does not read the input, so there is nothing to filter or index.
+	if (!partial_paths.empty() && (building_index || filter.is_active())) {
+		cout << "error: --build-index, --subreddit, --since and --until can not be used with --reduce" << endl;
+		return 1;
+	}
+	// the partial results do not have days in them.
+	if (bucketed && (!map_path.empty() || !partial_paths.empty())) {
+		cout << "error: --buckets can not be used with --map or --reduce" << endl;
+		return 1;
+	}
+	// the streaming mode does not keep the comments, so it can only print the list.
+	if (streaming && (bucketed || server || !map_path.empty() || !partial_paths.empty())) {
+		cout << "error: --streaming can not be used with --buckets, --serve, --map or --reduce" << endl;
+		return 1;
+	}
+	if (retention > 0 && !streaming) {
+		cout << "error: --retention can only be used with --streaming" << endl;
+		return 1;
+	}
+	if (seeded && sample_fraction == 0) {
+		cout << "error: --seed can only be used with --sample" << endl;
+		return 1;
+	}
+	// the sample is only good for a quick preview of the list.
+	if (sample_fraction > 0 && (bucketed || streaming || server || shards != 1 || !map_path.empty() || !partial_paths.empty())) {
+		cout << "error: --sample can not be used with --buckets, --streaming, --serve, --shard, --map or --reduce" << endl;
+		return 1;
+	}
+	// the spilled partitions are only read back by the second phase of the list (and
+	// they don't have the days of the comments).
+	if (memory_limit > 0 && (bucketed || streaming || server || sample_fraction > 0 || !map_path.empty())) {
+		cout << "error: --memory-limit can not be used with --buckets, --streaming, --serve, --sample or --map" << endl;
+		return 1;
+	}
+	// the running top list needs the comments of the whole input in memory (a spilled
+	// subreddit would start again from 0).
+	if (progress_interval > 0 && (sample_fraction > 0 || memory_limit > 0)) {
+		cout << "error: --progress can not be used with --sample or --memory-limit" << endl;
+		return 1;
+	}
+	// the list of the input files, the default file if there was no --input (the
+	// reducer does not read the input).
+	if (inputs.empty()) {
+		inputs.push_back("E:\\reddit\\reddit");
+	}
+	vector<string> files;
+	for (size_t i = 0; i < inputs.size() && partial_paths.empty(); ++i) {
+		if (!expand_input(inputs[i], files)) {
+			cout << "error: could not open " << inputs[i] << endl;
+			return 1;
+		}
+	}
+	if (files.empty() && partial_paths.empty()) {
+		cout << "error: no input files" << endl;
+		return 1;
+	}
+	if (building_index) {
+		return build_index(files) ? 0 : 1;
+	}
+	if (sample_fraction > 0) {
+		find_deepest_in_sample(files, filter, sample_fraction, seed, 10);
+		cin.get();
+		return 0;
+	}
+	if (streaming) {
+		SharedFileReader file_reader(files, get_file_ranges(files, shard, shards), filter);
+		if (!file_reader.is_open()) {
+			cout << "error: could not open the input files" << endl;
+			return 1;
+		}
+		find_deepest_streaming(file_reader, progress_interval, retention);
+		cin.get();
+		return 0;
+	}
+
+	// we first create shared assets and pass their reference for the threads, as well as
+	// provide the function to execute. 
+	Subreddits subreddits;
+	if (memory_limit > 0) {
+		subreddits.set_memory_limit(memory_limit << 20, spill_directory);
+	}
+	// the running top list and it's printer, only used in progressive mode.
+	ProgressiveTopList progress(10);
+	thread printer;
+	if (progress_interval > 0) {
+		subreddits.set_progress(&progress);
+	}
+
+	if (!partial_paths.empty()) {
+		// reducer: one thread for every partial result, they merge into the same map.
+		vector<thread> reducers;
+		deque<bool> results(partial_paths.size(), false);
+		if (progress_interval > 0) {
+			printer = thread(do_progress_work, ref(progress), progress_interval, 10);
+		}
+		for (size_t i = 0; i < partial_paths.size(); ++i) {
+			reducers.push_back(thread(do_reduce_work, partial_paths[i], ref(subreddits), ref(results[i])));
+		}
+		for (size_t i = 0; i < reducers.size(); ++i) {
+			reducers[i].join();
+			if (!results[i]) {
+				cout << "error: could not read partial result " << partial_paths[i] << endl;
+				return 1;
+			}
+		}
+		cout << "Finished with merging the partial results..." << endl;
+	}
+	else {
+		SharedFileReader file_reader(files, get_file_ranges(files, shard, shards), filter);
+		if (!file_reader.is_open()) {
+			cout << "error: could not open the input files" << endl;
+			return 1;
+		}
+
+		if (progress_interval > 0) {
+			printer = thread(do_progress_work, ref(progress), progress_interval, 10);
+		}
+
+		thread t1(do_work, ref(file_reader), ref(subreddits), bucketed);
+		thread t2(do_work, ref(file_reader), ref(subreddits), bucketed);
+		thread t3(do_work, ref(file_reader), ref(subreddits), bucketed);
+		thread t4(do_work, ref(file_reader), ref(subreddits), bucketed);
+		thread t5(do_work, ref(file_reader), ref(subreddits), bucketed);
+		thread t6(do_work, ref(file_reader), ref(subreddits), bucketed);
+		thread t7(do_work, ref(file_reader), ref(subreddits), bucketed);
+		thread t8(do_work, ref(file_reader), ref(subreddits), bucketed);
+
+		// wait for every thread to finish.
+		t1.join();
+		t2.join();
+		t3.join();
+		t4.join();
+		t5.join();
+		t6.join();
+		t7.join();
+		t8.join();
+		cout << "Finished with first multithreadding..." << endl;
+	}
+	if (progress_interval > 0) {
+		progress.finish();
+		printer.join();
+	}
+	if (!subreddits.spill_ok()) {
+		cout << "error: could not write the spilled partitions to " << spill_directory << endl;
+		return 1;
+	}
+
+	// a mapper only writes it's partial result, the reducer will do the second phase.
+	if (!map_path.empty()) {
+		if (!write_partial(map_path, subreddits)) {
+			cout << "error: could not write partial result " << map_path << endl;
+			return 1;
+		}
+		return 0;
+	}
+
+	// the second phase consumes the forests, so we measure them now for the server.
+	size_t forest_memory = server ? subreddits.memory_usage() : 0;
+
+	// create every asset for the second part and distribute them to the new threads.
+	TopList top(10);
+	BucketedLevels bucketed_levels;
+
+	// the spilled partitions one by one, then whatever was never spilled.
+	if (!find_deepest_spilled(subreddits, top, &bucketed_levels)) {
+		cout << "error: could not read the spilled partitions from " << spill_directory << endl;
+		return 1;
+	}
+	find_deepest(subreddits, top, &bucketed_levels);
 	cout << "Finished with second multithreadding..." << endl;
 
+	// in server mode the queries decide what gets printed.
+	if (server) {
+		serve(subreddits, forest_memory);
+		return 0;
+	}
+
+	// in bucketed mode we print a toplist for every day and week first.
+	if (bucketed) {
+		for (auto day = bucketed_levels.getDays()->begin(); day != bucketed_levels.getDays()->end(); ++day) {
+			cout << "--- day " << day_label(day->first) << " ---" << endl;
+			print_bucket(day->second);
+		}
+		map<long, FlatHashMap<string, vector<int>>> weeks;
+		bucketed_levels.build_weeks(weeks);
+		for (auto week = weeks.begin(); week != weeks.end(); ++week) {
+			cout << "--- week starting " << day_label(week->first * 7 - 3) << " ---" << endl;
+			print_bucket(week->second);
+		}
+		cout << "--- whole file ---" << endl;
+	}
+
 	// print results...
 	top.print();
 
@@ -0,0 +1,136 @@
+#!/bin/bash
+# check.sh : Checks that the other modes of the programs print the same top lists as
+# a normal run, on the synthetic input of tests/fixture.sh.
+#
+# usage: tests/check.sh [work directory]
+#
+# The programs are built with tools/build.sh. Every check runs a mode on the fixture,
+# and compares it's top list (the "name: number" lines) with the normal run of the
+# same program. ok or FAIL (with the difference) is printed for every check, and the
+# exit status is 1 if any of them failed.
+
+set -e
+work=${1:-$(mktemp -d)}
+tests=$(cd "$(dirname "$0")" && pwd)
+tools=$(cd "$tests/../tools" && pwd)
+mkdir -p "$work"
+cd "$work"
+
+"$tests/fixture.sh" fixture.json
+for task in task1 task2 task3; do
+	"$tools/build.sh" $task $task
+done
+
+# the top list of an output, a pair of exercise 2 with it's names in order (the order
+# of the two names depends on which thread found it first).
+toplist() {
+	awk -F': ' '/^[^ ].*: [0-9.e+-]+$/ {
+		if (split($1, names, ", ") == 2 && names[1] > names[2]) {
+			$1 = names[2] ", " names[1]
+		}
+		print $1 ": " $2
+	}' "$1"
+}
+
+failures=0
+
+# compare <check> <run> <output>: the top list of the output against the normal run
+# (<run>-default.list).
+compare() {
+	if toplist "$3" | diff "$2-default.list" - > "$2.diff"; then
+		echo "ok   $1"
+	else
+		echo "FAIL $1"
+		cat "$2.diff"
+		failures=$((failures + 1))
+	fi
+}
+
+for task in task1 task2 task3; do
+	./$task --input fixture.json </dev/null > $task-default.txt
+	toplist $task-default.txt > $task-default.list
+	if [ ! -s $task-default.list ]; then
+		echo "FAIL $task printed no top list"
+		failures=$((failures + 1))
+	fi
+done
+
+# map/reduce (--shard, --map, --reduce): three mappers, then the reducer.
+for task in task1 task2 task3; do
+	for shard in 0 1 2; do
+		./$task --input fixture.json --shard $shard/3 --map $task-part$shard </dev/null > /dev/null
+	done
+	./$task --reduce $task-part0 $task-part1 $task-part2 </dev/null > $task-reduce.txt
+	compare "$task --map/--reduce" $task $task-reduce.txt
+done
+
+# the approximate mode (--minhash) with the exact verification of it's best candidates.
+./task2 --input fixture.json --minhash --verify </dev/null > task2-minhash.txt
+compare "task2 --minhash --verify" task2 task2-minhash.txt
+
+# streaming (--streaming): the depths are resolved while reading, there is no second phase.
+./task3 --input fixture.json --streaming </dev/null > task3-streaming.txt
+compare "task3 --streaming" task3 task3-streaming.txt
+# with a retention of 240 hours nothing of the fixture's ten days is dropped too early.
+./task3 --input fixture.json --streaming --retention 240 </dev/null > task3-retention.txt
+compare "task3 --streaming --retention" task3 task3-retention.txt
+
+# the progressive mode (--progress) with an interval of a second: the program has to
+# exit, so the printer thread has stopped, and it's last snapshot is the list of the
+# whole input, which is exact in exercise 1 and 3. The normal list can come right
+# after the snapshot, so only as many lines are taken as the normal list has.
+final_snapshot() {
+	awk -v n=$(wc -l < "$2-default.list") '/^--- .*final/ { found = n; next } found > 0 { print; found-- }' "$1"
+}
+for task in task1 task3; do
+	if timeout 300 ./$task --input fixture.json --progress 1 </dev/null > $task-progress.txt; then
+		final_snapshot $task-progress.txt $task > $task-progress-final.txt
+		compare "$task --progress 1 (final snapshot)" $task $task-progress-final.txt
+	else
+		echo "FAIL $task --progress 1 did not exit"
+		failures=$((failures + 1))
+	fi
+done
+
+# the parallel second phase of exercise 3 (find_deepest_in_parallel), built with a
+# threshold of a thousand comments, so most subreddits of the fixture go through it.
+"$tools/build.sh" task3 task3_parallel -DGIANT_SUBREDDIT_COMMENTS=1000
+./task3_parallel --input fixture.json </dev/null > task3-parallel.txt
+compare "task3 parallel depths" task3 task3-parallel.txt
+
+# frozen dictionaries (--freeze-dictionary, --dictionary): one frozen from the whole
+# input, and one from the first third, so the rest of the words or authors go into the
+# normal map after the frozen ones. The second one is checked with map/reduce too, as
+# the partials only carry the words and authors they use.
+for task in task1 task2; do
+	./$task --input fixture.json --freeze-dictionary $task-all.dict </dev/null > /dev/null
+	./$task --input fixture.json --shard 0/3 --freeze-dictionary $task-part.dict </dev/null > /dev/null
+	./$task --input fixture.json --dictionary $task-all.dict </dev/null > $task-dictionary.txt
+	compare "$task --dictionary" $task $task-dictionary.txt
+	./$task --input fixture.json --dictionary $task-part.dict </dev/null > $task-part-dictionary.txt
+	compare "$task --dictionary (a third of the input)" $task $task-part-dictionary.txt
+	for shard in 0 1 2; do
+		./$task --input fixture.json --shard $shard/3 --dictionary $task-part.dict --map $task-dictionary-part$shard </dev/null > /dev/null
+	done
+	./$task --reduce $task-dictionary-part0 $task-dictionary-part1 $task-dictionary-part2 </dev/null > $task-dictionary-reduce.txt
+	compare "$task --dictionary --map/--reduce" $task $task-dictionary-reduce.txt
+done
+
+# spilling (--memory-limit, --spill) with the smallest limit, 1 Mb. The fixture is too
+# small for that, so this check has a larger one (200 thousand comments) and it's own
+# normal runs. It also fails if nothing was spilled.
+"$tests/fixture.sh" large.json 200000
+mkdir -p spill
+for task in task1 task2 task3; do
+	./$task --input large.json </dev/null > $task-large.txt
+	toplist $task-large.txt > $task-large-default.list
+	./$task --input large.json --memory-limit 1 --spill spill </dev/null > $task-spill.txt
+	if ! grep -q "^spilled partition" $task-spill.txt; then
+		echo "FAIL $task --memory-limit 1 did not spill"
+		failures=$((failures + 1))
+	fi
+	compare "$task --memory-limit 1 --spill" $task-large $task-spill.txt
+done
+
+echo "$failures failed"
+[ $failures -eq 0 ]
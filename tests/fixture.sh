@@ -0,0 +1,62 @@
+#!/bin/sh
+# fixture.sh : Writes the synthetic input of the checks in tests/check.sh.
+#
+# usage: tests/fixture.sh <output> [comments]
+#
+# 40 thousand comments (by default) of 12 subreddits over ten days, made by awk's rand
+# with seed 2, so the file is the same every time. The subreddits have different sizes
+# (sub0 has the most comments, more than a thousand, so it goes through the parallel
+# second phase of exercise 3 when that is built with a small threshold), and every
+# subreddit draws it's words and authors from a range of it's own size, overlapping
+# the others, so the vocabularies, the common authors and the depths are all
+# different and the top lists have no ties. 10% of the comments start a thread, the
+# others reply to one of the last 200 comments of their subreddit.
+
+set -e
+if [ $# -lt 1 ]; then
+	echo "usage: $0 <output> [comments]"
+	exit 1
+fi
+awk -v n="${2:-40000}" '
+function letters(i,   s) {
+	s = ""
+	do {
+		s = substr("abcdefghijklmnopqrstuvwxyz", i % 26 + 1, 1) s
+		i = int(i / 26)
+	} while (i > 0)
+	return s
+}
+function b36(i,   s) {
+	s = ""
+	do {
+		s = substr("0123456789abcdefghijklmnopqrstuvwxyz", i % 36 + 1, 1) s
+		i = int(i / 36)
+	} while (i > 0)
+	return s
+}
+BEGIN {
+	srand(2)
+	for (i = 0; i < n; ++i) {
+		s = int(12 * rand() * rand())
+		name = "t1_" b36(i + 1000)
+		if (count[s] == 0 || rand() < 0.1) {
+			link = "t3_" b36(i + 1000)
+			parent = link
+		}
+		else {
+			j = count[s] - 1 - int(rand() * (count[s] < 200 ? count[s] : 200))
+			link = links[s, j % 200]
+			parent = names[s, j % 200]
+		}
+		names[s, count[s] % 200] = name
+		links[s, count[s] % 200] = link
+		count[s]++
+		body = ""
+		words = 3 + int(rand() * 12)
+		for (w = 0; w < words; ++w) {
+			body = body (w > 0 ? " " : "") letters(int(rand() * rand() * (20000 + 15000 * s)))
+		}
+		author = "u" int(rand() * rand() * (20000 + 10000 * s) + 2000 * s)
+		printf "{\"subreddit\":\"sub%d\",\"author\":\"%s\",\"body\":\"%s\",\"name\":\"%s\",\"parent_id\":\"%s\",\"link_id\":\"%s\",\"created_utc\":%d}\n", s, author, body, name, parent, link, 1500000000 + int(i * 864000 / n)
+	}
+}' > "$1"
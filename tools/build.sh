@@ -0,0 +1,36 @@
+#!/bin/sh
+# build.sh : Builds one of the programs with g++ (or $CXX) outside Visual Studio, for
+# the checks in tests/ and the drivers in benchmarks/.
+#
+# usage: tools/build.sh <task1|task2|task3|file.cpp> <output> [compiler flags...]
+#
+# json.hpp is taken from $JSON_INCLUDE if it's there, otherwise from nlohmann/json.hpp
+# in the include path of the compiler. stdafx.h (the precompiled header of Visual
+# Studio) is an empty file here, and sstream and iterator are included up front, as
+# the Visual Studio headers include them with the others.
+
+set -e
+if [ $# -lt 2 ]; then
+	echo "usage: $0 <task1|task2|task3|file.cpp> <output> [compiler flags...]"
+	exit 1
+fi
+repo=$(cd "$(dirname "$0")/.." && pwd)
+source=$1
+output=$2
+shift 2
+case $source in
+	*.cpp) ;;
+	*) source=$repo/$source.cpp ;;
+esac
+
+include=$(mktemp -d)
+trap 'rm -rf "$include"' EXIT
+: > "$include/stdafx.h"
+if [ -n "$JSON_INCLUDE" ] && [ -f "$JSON_INCLUDE/json.hpp" ]; then
+	cp "$JSON_INCLUDE/json.hpp" "$include/json.hpp"
+else
+	echo '#include <nlohmann/json.hpp>' > "$include/json.hpp"
+fi
+
+${CXX:-g++} -std=c++14 -O2 -pthread -I"$include" -I"$repo" -include sstream -include iterator \
+	$CXXFLAGS "$@" "$source" -o "$output"